@@ -8,11 +8,19 @@
 #include <numeric>
 #include <unordered_map>
 #include <cstring>
+#include <sstream>
 #include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "../shared/model.h"
 #include "../shared/input.h"
 #include "../shared/analysis.h"
 #include "../shared/reachability.h"
+#include "../shared/dominators.h"
+#include "../shared/purge_search.h"
+#include "../shared/purge_matrix.h"
 
 using namespace std;
 
@@ -48,41 +56,100 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
         }
 
         cerr << "Running DFS on original graph...";
-        BFS all = BFS::run<false>(adj);
-        cerr << " " << std::count_if(all.method_inhibited.begin(), all.method_inhibited.end(), [](bool b) { return b; }) << " methods reachable!\n";
+        BFS<false> all = BFS<false>::run(adj);
+        cerr << " " << all.methods.count_inhibited() << " methods reachable!\n";
 
         cerr << "Running DFS on purged graph...";
 
-        BFS after_purge = BFS::run<false>(adj, purged_mids);
+        BFS<false> after_purge = BFS<false>::run(adj, purged_mids);
 
-        cerr << " " << std::count_if(after_purge.method_inhibited.begin(), after_purge.method_inhibited.end(), [](bool b) { return b; }) << " methods reachable!\n";
+        cerr << " " << after_purge.methods.count_inhibited() << " methods reachable!\n";
 
-        for(size_t i = 1; i < all.method_inhibited.size(); i++)
+        for(size_t i = 1; i < all.methods.size(); i++)
         {
-            if(all.method_inhibited[i] && !after_purge.method_inhibited[i])
+            if(all.methods.inhibited(i) && !after_purge.methods.inhibited(i))
                 cout << method_names[i] << endl;
         }
     }
+    else if(command == "gain")
+    {
+        vector<method_id> purged_mids;
+        string name;
+
+        while(getline(cin, name) && !name.empty())
+            purged_mids.push_back(resolve_method(method_ids_by_name, name));
+
+        BfsWorkspace<false> workspace(adj);
+        uint64_t unpurged_cost = workspace.run().reached_cost;
+        cout << (unpurged_cost - workspace.run(purged_mids).reached_cost) << endl;
+    }
+    else if(command == "targeted")
+    {
+        // Purged methods, followed by an empty line and the target methods
+        vector<method_id> purged_mids;
+        vector<method_id> target_mids;
+        vector<method_id>* mids = &purged_mids;
+        string name;
+
+        while(getline(cin, name))
+        {
+            if(name.length() == 0)
+            {
+                if(mids == &target_mids)
+                    break;
+                mids = &target_mids;
+                continue;
+            }
+
+            mids->push_back(resolve_method(method_ids_by_name, name));
+        }
+
+        vector<bool> reachable = simulate_purge_targeted(adj, purged_mids, target_mids);
+
+        for(size_t i = 0; i < target_mids.size(); i++)
+            cout << method_names[target_mids[i].id] << ": " << (reachable[i] ? "reachable" : "purged") << endl;
+    }
     else if(command == "benchmark")
     {
         constexpr int times = 20;
 
+        size_t typeflow_pops = 0;
+        size_t typeflow_pushes_deduplicated = 0;
+        size_t method_levels = 0;
+        size_t method_levels_bottom_up = 0;
+
         auto start = std::chrono::system_clock::now();
 
         for(size_t i = 0; i < times; i++)
         {
-            auto _ = BFS::run<false>(adj);
+            auto r = BFS<false>::run(adj);
+            typeflow_pops += r.stats.typeflow_pops;
+            typeflow_pushes_deduplicated += r.stats.typeflow_pushes_deduplicated;
+            method_levels += r.stats.method_levels;
+            method_levels_bottom_up += r.stats.method_levels_bottom_up;
         }
 
         auto end = std::chrono::system_clock::now();
         std::chrono::duration<double> elapsed_seconds = end-start;
         cout << (elapsed_seconds.count() / times) << " s" << endl;
+        cout << (typeflow_pops / times) << " typeflow pops (" << ((typeflow_pops + typeflow_pushes_deduplicated) / times) << " without deduplication)" << endl;
+        cout << (method_levels / times) << " method levels (" << (method_levels_bottom_up / times) << " bottom-up)" << endl;
+
+        BfsWorkspace<false> workspace(adj);
+        start = std::chrono::system_clock::now();
+
+        for(size_t i = 0; i < times; i++)
+            workspace.run();
+
+        end = std::chrono::system_clock::now();
+        elapsed_seconds = end-start;
+        cout << (elapsed_seconds.count() / times) << " s with reused workspace" << endl;
     }
     else if(command == "bfs-incremental")
     {
-        BFS all_reachable = BFS::run<false>(adj);
-        cerr << " " << std::count_if(all_reachable.method_inhibited.begin(), all_reachable.method_inhibited.end(), [](bool b) { return b; }) << " methods reachable!\n";
-        cerr << " " << std::count_if(all_reachable.method_history.begin(), all_reachable.method_history.end(), [](auto h) { return bool(h); }) << " methods reachable!\n";
+        BFS<false> all_reachable = BFS<false>::run(adj);
+        cerr << " " << all_reachable.methods.count_inhibited() << " methods reachable!\n";
+        cerr << " " << all_reachable.methods.count_visited() << " methods reachable!\n";
 
         vector<method_id> all_methods(adj.n_methods() - 1);
         std::iota(all_methods.begin(), all_methods.end(), 1);
@@ -92,7 +159,7 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
 
         vector<bool> mid_called(adj.n_methods() - 1);
 
-        auto callback = [&](const PurgeTreeNode& node, const BFS& r)
+        auto callback = [&](const PurgeTreeNode& node, const BFS<false>& r)
         {
             size_t iteration = &node - &all_method_singletons[0];
             if(mid_called.at(iteration))
@@ -105,29 +172,29 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
 #if REACHABILITY_ASSERTIONS
             {
                 {
-                    BFS ref = BFS::run(adj, node.mids);
+                    BFS<true> ref = BFS<true>::run(adj, node.mids);
                     assert_reachability_equals(r, ref);
                 }
 
                 {
-                    BFS r_copy = r;
+                    BFS<false> r_copy = r;
                     method_id root_methods[node.mids.size()];
                     size_t root_methods_size = 0;
 
                     for(method_id mid : node.mids)
                     {
-                        r_copy.method_inhibited[mid.id] = false;
+                        r_copy.methods.uninhibit(mid);
                         const auto& m = adj[mid];
                         if(
                                 std::any_of(m.backward_edges.begin(), m.backward_edges.end(), [&](const auto& item)
                                 {
-                                    return (bool) r_copy.method_history[item.id];
+                                    return r_copy.methods.visited(item);
                                 })
                                 ||
                                 std::any_of(m.backward_hyperedges.begin(), m.backward_hyperedges.end(), [&](const auto& item)
                                 {
                                     const auto& he = adj[item];
-                                    return (bool)r.method_history[he.src1.id] && (bool)r.method_history[he.src2.id];
+                                    return r.methods.visited(he.src1) && r.methods.visited(he.src2);
                                 })
                                 ||
                                 std::any_of(m.virtual_invocation_sources.begin(), m.virtual_invocation_sources.end(), [&](const auto& item)
@@ -140,7 +207,7 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
                         }
                     }
 
-                    r_copy.run<false, false>(adj, {root_methods, root_methods_size}, false);
+                    r_copy.run(adj, {root_methods, root_methods_size}, false);
                     assert_reachability_equals(all_reachable, r_copy);
                 }
             }
@@ -154,9 +221,9 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
 
             cout << ": ";
 
-            for(size_t i = 1; i < r.method_history.size(); i++)
+            for(size_t i = 1; i < r.methods.size(); i++)
             {
-                if(!r.method_history[i] && all_reachable.method_history[i])
+                if(!r.methods.visited(i) && all_reachable.methods.visited(i))
                     cout << method_names[i] << ' ';
             }
             cout << endl;
@@ -168,7 +235,12 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
 #endif
         };
 
-        bfs_incremental(adj, all_method_singletons, callback);
+        auto start = std::chrono::system_clock::now();
+        auto stats = bfs_incremental(adj, all_method_singletons, callback);
+        auto end = std::chrono::system_clock::now();
+        std::chrono::duration<double> elapsed_seconds = end-start;
+
+        cerr << elapsed_seconds.count() << " s, " << stats.method_visits << " method visits, " << stats.typeflow_pops << " typeflow pops" << endl;
 
         if(!std::all_of(mid_called.begin(), mid_called.end(), [](bool b) { return b; }))
         {
@@ -179,8 +251,8 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
     else
     {
         cerr << "Running DFS on original graph...";
-        BFS all = BFS::run<false>(adj);
-        cerr << " " << std::count_if(all.method_inhibited.begin(), all.method_inhibited.end(), [](bool b) { return b; }) << " methods reachable!\n";
+        BFS<false> all = BFS<false>::run(adj);
+        cerr << " " << all.methods.count_inhibited() << " methods reachable!\n";
         auto n_visited_typeflows = std::count_if(all.typeflow_visited.begin(), all.typeflow_visited.end(), [](const auto& history){ return history.any(); });
         cerr << "typeflows visited: " << n_visited_typeflows << " / " << all.typeflow_visited.size() << endl;
 
@@ -188,13 +260,13 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
         {
             cout << adj.n_methods() << '\n';
             for(size_t i = 0; i < adj.n_methods(); i++)
-                cout << (all.method_inhibited[i] + '0') << '\n';
+                cout << (all.methods.inhibited(i) + '0') << '\n';
         }
         if(command == "all")
         {
             cout << adj.n_methods() << ' ' << adj.n_typeflows() << '\n';
             for(size_t i = 0; i < adj.n_methods(); i++)
-                cout << (all.method_inhibited[i] + '0') << '\n';
+                cout << (all.methods.inhibited(i) + '0') << '\n';
 
             vector<uint16_t> types;
 
@@ -219,7 +291,7 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
         {
             cout << adj.n_methods() << ' ' << adj.n_typeflows() << '\n';
             for(size_t i = 0; i < adj.n_methods(); i++)
-                cout << (all.method_inhibited[i] + '0') << '\n';
+                cout << (all.methods.inhibited(i) + '0') << '\n';
 
             vector<pair<uint16_t, uint8_t>> types;
 
@@ -242,9 +314,9 @@ static void simulate_purge(Adjacency& adj, const vector<string>& method_names, c
         }
         else if(command == "missing")
         {
-            for(size_t i = 1; i < all.method_inhibited.size(); i++)
+            for(size_t i = 1; i < all.methods.size(); i++)
             {
-                if(!all.method_inhibited[i])
+                if(!all.methods.inhibited(i))
                     cout << method_names[i] << endl;
             }
         }
@@ -289,7 +361,7 @@ static vector<method_id> parse_methods(const model& m, const char* methods)
 
 static void print_reachability(const model& m)
 {
-    BFS bfsresult = BFS::run(m.adj);
+    BFS<true> bfsresult = BFS<true>::run(m.adj);
 
     string input;
     getline(cin, input);
@@ -299,17 +371,18 @@ static void print_reachability(const model& m)
     if(purged_mids.empty())
         return;
 
+    ReachabilityExplainer explainer(m.adj, bfsresult);
     vector<bool> visited(m.adj.n_methods());
     bool any_reachable = false;
 
     for(method_id mid : purged_mids)
     {
-        if(!bfsresult.method_inhibited[mid.id])
+        if(!bfsresult.methods.inhibited(mid))
             continue;
 
         any_reachable = true;
         TreeIndenter indentation;
-        print_reachability_of_method(cout, m.adj, m.method_names, m.type_names, bfsresult, mid, visited, indentation);
+        print_reachability_of_method(cout, m.method_names, m.type_names, explainer, mid, visited, indentation);
     }
 
     if(!any_reachable)
@@ -318,7 +391,7 @@ static void print_reachability(const model& m)
 
 static void compute_and_write_purge_matrix(const model& m, ostream& out)
 {
-    BFS all_reachable = BFS::run<false>(m.adj);
+    BFS<false> all_reachable = BFS<false>::run(m.adj);
 
     vector<method_id> all_methods(m.adj.n_methods() - 1);
     std::iota(all_methods.begin(), all_methods.end(), 1);
@@ -328,7 +401,7 @@ static void compute_and_write_purge_matrix(const model& m, ostream& out)
 
     size_t cur_iteration = 0;
 
-    auto callback = [&](const PurgeTreeNode& node, const BFS& r)
+    auto callback = [&](const PurgeTreeNode& node, const BFS<false>& r)
     {
         size_t iteration = &node - &all_method_singletons[0];
 
@@ -336,12 +409,12 @@ static void compute_and_write_purge_matrix(const model& m, ostream& out)
             exit(99);
         cur_iteration++;
 
-        size_t rawBytesSize = (r.method_history.size() + 7) / 8;
+        size_t rawBytesSize = (r.methods.size() + 7) / 8;
         uint8_t rawBytes[rawBytesSize];
         fill(rawBytes, rawBytes + rawBytesSize, 0);
 
-        for(size_t i = 0; i < r.method_history.size(); i++)
-            rawBytes[i / 8] |= bool(r.method_history[i]) << (i % 8);
+        for(size_t i = 0; i < r.methods.size(); i++)
+            rawBytes[i / 8] |= r.methods.visited(i) << (i % 8);
 
         out.write((char*)rawBytes, rawBytesSize);
     };
@@ -349,11 +422,104 @@ static void compute_and_write_purge_matrix(const model& m, ostream& out)
     bfs_incremental(m.adj, all_method_singletons, callback);
 }
 
+// Same rows as compute_and_write_purge_matrix, in the format of SparsePurgeMatrix
+static void compute_and_write_sparse_purge_matrix(const model& m, ostream& out, bool transposed)
+{
+    BFS<false> all_reachable = BFS<false>::run(m.adj);
+    SparsePurgeMatrixWriter writer(all_reachable.methods, transposed);
+
+    vector<method_id> all_methods(m.adj.n_methods() - 1);
+    std::iota(all_methods.begin(), all_methods.end(), 1);
+    vector<PurgeTreeNode> all_method_singletons(m.adj.n_methods() - 1);
+    for(size_t i = 0; i < all_method_singletons.size(); i++)
+        all_method_singletons[i] = {{&all_methods[i], 1}, {}};
+
+    size_t cur_iteration = 0;
+
+    auto callback = [&](const PurgeTreeNode& node, const BFS<false>& r)
+    {
+        size_t iteration = &node - &all_method_singletons[0];
+
+        if(iteration != cur_iteration)
+            exit(99);
+        cur_iteration++;
+
+        writer.add_purge(r.methods);
+    };
+
+    bfs_incremental(m.adj, all_method_singletons, callback);
+    writer.write(out);
+}
+
+// Read-only mapping of a whole file, such that only the touched pages get loaded
+class MappedFile
+{
+    void* data = MAP_FAILED;
+    size_t size = 0;
+
+public:
+    explicit MappedFile(const char* path)
+    {
+        int fd = open(path, O_RDONLY);
+        if(fd < 0)
+            return;
+
+        struct stat st{};
+        if(fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            size = st.st_size;
+            data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+
+        close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        if(data != MAP_FAILED)
+            munmap(data, size);
+    }
+
+    [[nodiscard]] span<const uint8_t> bytes() const
+    {
+        if(data == MAP_FAILED)
+            return {};
+        return {(const uint8_t*)data, size};
+    }
+};
+
+/* For each method name read from stdin, writes the row of the sparse purge matrix:
+ * The methods that its purge makes unreachable, or, if transposed, the methods whose purge makes it unreachable. */
+static void print_sparse_purge_matrix_rows(const model& m, const char* path)
+{
+    MappedFile file(path);
+    SparsePurgeMatrix matrix(file.bytes());
+
+    if(!matrix.valid() || matrix.n_methods() != m.adj.n_methods() || matrix.n_rows() != m.adj.n_methods() - !matrix.transposed())
+    {
+        cerr << path << " is no sparse purge matrix of this model!" << endl;
+        exit(1);
+    }
+
+    string name;
+
+    while(getline(cin, name) && !name.empty())
+    {
+        method_id mid = resolve_method(m.method_ids_by_name, name);
+
+        cout << name << ':';
+        matrix.for_each_in_row(matrix.transposed() ? mid.id : mid.id - 1, [&](method_id other) { cout << ' ' << m.method_names[other.id]; });
+        cout << '\n';
+    }
+}
+
 static vector<vector<bool>> compute_purge_matrix(const model& m)
 {
     vector<vector<bool>> result(m.adj.n_methods() - 1);
 
-    BFS all_reachable = BFS::run<false>(m.adj);
+    BFS<false> all_reachable = BFS<false>::run(m.adj);
 
     vector<method_id> all_methods(m.adj.n_methods() - 1);
     std::iota(all_methods.begin(), all_methods.end(), 1);
@@ -361,14 +527,14 @@ static vector<vector<bool>> compute_purge_matrix(const model& m)
     for(size_t i = 0; i < all_method_singletons.size(); i++)
         all_method_singletons[i] = {{&all_methods[i], 1}, {}};
 
-    auto callback = [&](const PurgeTreeNode& node, const BFS& r)
+    auto callback = [&](const PurgeTreeNode& node, const BFS<false>& r)
     {
         size_t iteration = &node - &all_method_singletons[0];
 
-        result[iteration].resize(r.method_history.size());
+        result[iteration].resize(r.methods.size());
 
-        for(size_t i = 0; i < r.method_history.size(); i++)
-            result[iteration][i] = (bool)r.method_history[i];
+        for(size_t i = 0; i < r.methods.size(); i++)
+            result[iteration][i] = r.methods.visited(i);
     };
 
     bfs_incremental(m.adj, all_method_singletons, callback);
@@ -406,42 +572,420 @@ void check_redundant_typeflow_correctness(model& m)
     }
 }
 
-static void show_data_info(model& m)
+static void write_purge_gains(const model& m, ostream& out)
 {
-    {
-        size_t singleton_filter_count = std::count_if(m.adj.flows.begin(), m.adj.flows.end(), [](const auto& f){ return f.filter.count() == 1; });
-        cout << "singleton_filter: " << (100.0 * singleton_filter_count / m.adj.n_typeflows()) << endl;
-    }
+    size_t n_simulated;
+    auto start = std::chrono::system_clock::now();
+    vector<uint64_t> gains = compute_singleton_purge_gains(m.adj, &n_simulated);
+    auto end = std::chrono::system_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end-start;
+
+    cerr << elapsed_seconds.count() << " s, " << n_simulated << " methods needed simulation" << endl;
+
+    for(size_t i = 1; i < m.adj.n_methods(); i++)
+        out << m.method_names[i] << ": " << gains[i] << '\n';
+}
 
-    BFS res = BFS::run(m.adj);
+/* Every input line lists edges to remove together, as pairs of kind (call, interflow or hyperedge) and index in the input file.
+ * For each line, the PurgeGain of removing them gets written, or "contracted" if some of them got merged with others
+ * by the typeflow optimization, or "instantiating" if some of them feed types with costs from the white hole. A parallel edge only goes away once all its copies are listed. */
+static void write_edge_purge_gains(const model& m)
+{
+    EdgeOverlay overlay(m.adj);
+    BfsWorkspace<false> workspace(m.adj, &overlay);
+    uint64_t unpurged_cost = workspace.run().reached_cost;
+    string line;
 
+    while(getline(cin, line))
     {
-        size_t singleton_filter_count = 0;
-        for(size_t i = 0; i < m.adj.n_typeflows(); i++)
-            singleton_filter_count += res.typeflow_visited[i].any() && m.adj.flows[i].filter.count() == 1;
-        size_t all_count = std::count_if(res.typeflow_visited.begin(), res.typeflow_visited.end(), [](const auto& h){ return h.any(); });
-        cout << "singleton_filter for reachable nodes: " << (100.0 * singleton_filter_count / all_count) << endl;
+        vector<uint32_t> direct_invokes, interflows, hyperedges;
+        istringstream in(line);
+        string kind;
+        size_t index;
+
+        while(in >> kind >> index)
+        {
+            if(kind == "call")
+                direct_invokes.push_back(index);
+            else if(kind == "interflow")
+                interflows.push_back(index);
+            else if(kind == "hyperedge")
+                hyperedges.push_back(index);
+            else
+            {
+                cerr << "Invalid edge kind: " << kind << endl;
+                exit(1);
+            }
+        }
+
+        switch(mask_input_edges(overlay, m, direct_invokes, interflows, hyperedges))
+        {
+            case EdgeMasking::masked:
+                cout << (unpurged_cost - workspace.run().reached_cost) << '\n';
+                break;
+            case EdgeMasking::contracted:
+                cout << "contracted\n";
+                break;
+            case EdgeMasking::instantiating:
+                cout << "instantiating\n";
+                break;
+            case EdgeMasking::out_of_range:
+                cerr << "Edge index out of range: " << line << endl;
+                exit(1);
+        }
+
+        overlay.clear();
     }
 }
 
-int main(int argc, const char** argv)
+static model_data read_model_data()
 {
     model_data data;
 
     read_lines(data.type_names, "types.txt");
     read_lines(data.method_names, "methods.txt");
     read_lines(data.typeflow_names, "typeflows.txt");
-    read_typestate_bitsets(data.type_names.size(), data.typestates, "typestates.bin");
+    read_typestate_bitsets(data.type_names.size(), data.typestate_blocks, data.typestates, "typestates.bin");
     read_buffer(data.interflows, "interflows.bin");
     read_buffer(data.direct_invokes, "direct_invokes.bin");
     read_buffer(data.containing_methods, "typeflow_methods.bin");
     read_buffer(data.typeflow_filters, "typeflow_filters.bin");
     read_buffer(data.hyper_edges, "hyper_edges.bin");
 
-    data.typeflow_names.resize(data.typeflow_filters.size());
+    // Optional, with one cost per line of methods.txt and types.txt. The root isn't part of methods.txt, so it gets no entry.
+    if(filesystem::exists("method_costs.bin"))
+        read_buffer(data.method_costs, "method_costs.bin");
+    if(filesystem::exists("type_costs.bin"))
+        read_buffer(data.type_costs, "type_costs.bin");
+
+    if(!data.costs_match())
+    {
+        cerr << "method_costs.bin needs one cost per method of methods.txt, type_costs.bin one per type of types.txt" << endl;
+        exit(1);
+    }
+
+    data.typeflow_names.resize(data.typeflow_filters.size() + 1);
+    return data;
+}
+
+// Same data, but with arbitrary type costs, such that the checks also cover the accounting of instantiated types
+static model_data with_type_costs(model_data data)
+{
+    data.type_costs.resize(data.type_names.size());
+    for(size_t t = 0; t < data.type_costs.size(); t++)
+        data.type_costs[t] = (uint32_t)(t * 2654435761u) >> 25;
+    return data;
+}
+
+// Runs the check on the model, and once more with type costs
+static void check_with_type_costs(const model& m, void (*check)(const model&))
+{
+    check(m);
 
+    model typed(with_type_costs(read_model_data()));
+    typed.optimize();
+    check(typed);
+}
+
+void check_purge_gains_correctness(const model& m)
+{
+    vector<uint64_t> gains = compute_singleton_purge_gains(m.adj);
+    BfsWorkspace<false> workspace(m.adj);
+    uint64_t unpurged_cost = workspace.run().reached_cost;
+
+    for(size_t i = 1; i < m.adj.n_methods(); i++)
+    {
+        method_id purged = i;
+        uint64_t expected = unpurged_cost - workspace.run({&purged, 1}).reached_cost;
+
+        if(gains[i] != expected)
+            cerr << m.method_names[i] << ": " << gains[i] << " instead of " << expected << endl;
+    }
+}
+
+/* Purge tree of nested ranges of methods, each node purging some methods of its own and those of its children.
+ * Covers what the purge trees of the observatory do, unlike the singleton purges of the other commands. */
+struct NestedPurgeTree
+{
+    vector<method_id> mids;
+    // Per node, the number of leading mids that are its own, the others belong to its children
+    vector<size_t> own_counts;
+    vector<PurgeTreeNode> nodes;
+    // Indices of the parent node, or the node itself at the top level
+    vector<size_t> parents;
+    span<const PurgeTreeNode> top_level;
+
+    NestedPurgeTree(size_t n_methods, size_t fanout, size_t depth) : mids(n_methods - 1)
+    {
+        std::iota(mids.begin(), mids.end(), 1);
+
+        size_t n_nodes = 0;
+        for(size_t level = 1, width = fanout; level <= depth; level++, width *= fanout)
+            n_nodes += width;
+        // The spans of the parents refer into it, so it must not reallocate
+        nodes.reserve(n_nodes);
+
+        top_level = build(0, mids.size(), fanout, depth, SIZE_MAX);
+    }
+
+private:
+    span<const PurgeTreeNode> build(size_t begin, size_t end, size_t fanout, size_t depth, size_t parent)
+    {
+        size_t first = nodes.size();
+        size_t n = min(fanout, end - begin);
+
+        for(size_t i = 0; i < n; i++)
+        {
+            nodes.push_back({});
+            parents.push_back(parent == SIZE_MAX ? first + i : parent);
+            own_counts.push_back(0);
+        }
+
+        for(size_t i = 0; i < n; i++)
+        {
+            size_t node_begin = begin + (end - begin) * i / n;
+            size_t node_end = begin + (end - begin) * (i + 1) / n;
+            size_t own = depth > 1 ? min((size_t)2, node_end - node_begin) : node_end - node_begin;
+
+            own_counts[first + i] = own;
+            span<const PurgeTreeNode> children;
+            if(depth > 1 && node_begin + own < node_end)
+                children = build(node_begin + own, node_end, fanout, depth - 1, first + i);
+
+            nodes[first + i] = {span<const method_id>(mids).subspan(node_begin, node_end - node_begin), children};
+        }
+
+        return span<const PurgeTreeNode>(nodes).subspan(first, n);
+    }
+
+public:
+    // What IncrementalBfs simulates for the node: Its mids and the own ones of its ancestors stay purged
+    [[nodiscard]] vector<method_id> purge_set(const PurgeTreeNode* node) const
+    {
+        size_t i = node - nodes.data();
+        vector<method_id> set(node->mids.begin(), node->mids.end());
+
+        while(parents[i] != i)
+        {
+            i = parents[i];
+            set.insert(set.end(), nodes[i].mids.begin(), nodes[i].mids.begin() + own_counts[i]);
+        }
+
+        return set;
+    }
+};
+
+// Compares the result of each node of a nested purge tree with a simulation from scratch
+static void check_incremental_correctness(const model& m)
+{
+    NestedPurgeTree tree(m.adj.n_methods(), 6, 3);
+    BfsWorkspace<false> workspace(m.adj);
+    IncrementalBfs ibfs(m.adj, tree.top_level);
+    size_t n_checked = 0;
+    size_t n_wrong = 0;
+
+    while(const PurgeTreeNode* node = ibfs.next())
+    {
+        const BFS<false>& expected = workspace.run(tree.purge_set(node));
+        const BFS<false>& r = ibfs.current_result();
+
+        if(r.reached_cost != expected.reached_cost || r.methods.visited_words() != expected.methods.visited_words())
+        {
+            cerr << "Purge tree node " << (node - tree.nodes.data()) << ": " << r.reached_cost << " instead of " << expected.reached_cost << endl;
+            n_wrong++;
+        }
+        n_checked++;
+    }
+
+    cerr << n_wrong << " of " << n_checked << " purge tree nodes differ" << endl;
+    if(n_wrong || n_checked != tree.nodes.size())
+        exit(1);
+}
+
+// Input edges without the one at index, or with a copy of it appended
+template<typename Id>
+static MallocBuffer<Edge<Id>> edit_edges(const MallocBuffer<Edge<Id>>& edges, size_t index, bool duplicate)
+{
+    MallocBuffer<Edge<Id>> res(duplicate ? edges.size() + 1 : edges.size() - 1);
+    std::copy(edges.data(), edges.data() + index, res.data());
+
+    if(duplicate)
+    {
+        std::copy(edges.data() + index, edges.data() + edges.size(), res.data() + index);
+        res[edges.size()] = edges[index];
+    }
+    else
+    {
+        std::copy(edges.data() + index + 1, edges.data() + edges.size(), res.data() + index);
+    }
+
+    return res;
+}
+
+static uint64_t rebuilt_reached_cost(model_data data)
+{
     model m(std::move(data));
     m.optimize();
+    return BFS<false>::run(m.adj).reached_cost;
+}
+
+// Reached cost without the edges, or nullopt if they can't be simulated
+static optional<uint64_t> overlay_reached_cost(const model& m, EdgeOverlay& overlay, BfsWorkspace<false>& workspace, span<const uint32_t> direct_invokes, span<const uint32_t> interflows, span<const uint32_t> hyperedges)
+{
+    optional<uint64_t> res;
+    if(mask_input_edges(overlay, m, direct_invokes, interflows, hyperedges) == EdgeMasking::masked)
+        res = workspace.run().reached_cost;
+    overlay.clear();
+    return res;
+}
+
+/* Compares edge purge gains on the overlay with rebuilding the model without the edges, for a sample of each kind.
+ * Sampled calls also get a parallel copy, which must only make a difference once both copies are removed. */
+static void check_edge_purge_gains_correctness(const model& m)
+{
+    constexpr size_t n_samples = 24;
+    EdgeOverlay overlay(m.adj);
+    BfsWorkspace<false> workspace(m.adj, &overlay);
+    uint64_t unpurged_cost = workspace.run().reached_cost;
+    size_t n_checked = 0;
+    size_t n_wrong = 0;
+
+    auto compare = [&](const char* kind, size_t index, optional<uint64_t> actual, uint64_t expected) {
+        if(!actual)
+            return;
+        if(*actual != expected)
+        {
+            cerr << kind << ' ' << index << ": " << *actual << " instead of " << expected << endl;
+            n_wrong++;
+        }
+        n_checked++;
+    };
+
+    // The rebuilt models need the same costs, which may not be the ones of the input
+    auto read_data = [&]
+    {
+        model_data data = read_model_data();
+        data.type_costs = m.adj.type_costs;
+        return data;
+    };
+
+    auto sample = [&](size_t n, size_t i) { return n * i / n_samples; };
+
+    for(size_t i = 0; i < n_samples && i < m.direct_invokes.size(); i++)
+    {
+        uint32_t index = sample(m.direct_invokes.size(), i);
+
+        model_data data = read_data();
+        data.direct_invokes = edit_edges(data.direct_invokes, index, false);
+        uint64_t expected = rebuilt_reached_cost(std::move(data));
+        compare("call", index, overlay_reached_cost(m, overlay, workspace, {&index, 1}, {}, {}), expected);
+
+        data = read_data();
+        data.direct_invokes = edit_edges(data.direct_invokes, index, true);
+        model duplicated(std::move(data));
+        duplicated.optimize();
+        EdgeOverlay duplicated_overlay(duplicated.adj);
+        BfsWorkspace<false> duplicated_workspace(duplicated.adj, &duplicated_overlay);
+        uint32_t both[] = {index, (uint32_t)m.direct_invokes.size()};
+        compare("call", index, overlay_reached_cost(duplicated, duplicated_overlay, duplicated_workspace, {both, 1}, {}, {}), unpurged_cost);
+        compare("call", index, overlay_reached_cost(duplicated, duplicated_overlay, duplicated_workspace, both, {}, {}), expected);
+    }
+
+    for(size_t i = 0; i < n_samples && i < m.interflows.size(); i++)
+    {
+        uint32_t index = sample(m.interflows.size(), i);
+
+        model_data data = read_data();
+        data.interflows = edit_edges(data.interflows, index, false);
+        compare("interflow", index, overlay_reached_cost(m, overlay, workspace, {}, {&index, 1}, {}), rebuilt_reached_cost(std::move(data)));
+    }
+
+    for(size_t i = 0; i < n_samples && i < m.adj.n_hyperedges(); i++)
+    {
+        uint32_t index = sample(m.adj.n_hyperedges(), i);
+
+        model_data data = read_data();
+        data.hyper_edges.erase(data.hyper_edges.begin() + index);
+        compare("hyperedge", index, overlay_reached_cost(m, overlay, workspace, {}, {}, {&index, 1}), rebuilt_reached_cost(std::move(data)));
+    }
+
+    cerr << n_wrong << " of " << n_checked << " edge sets differ" << endl;
+    if(n_wrong)
+        exit(1);
+}
+
+static vector<PurgeCandidate> purge_candidates(const model& m, const PurgeDominance& d, int argc, const char** argv)
+{
+    bool classes = argc > 3 && string_view(argv[3]) == "classes";
+    return classes ? class_purge_candidates(d.all, m.method_names) : method_purge_candidates(d.all, m.method_names);
+}
+
+static size_t parse_count_argument(int argc, const char** argv)
+{
+    if(argc <= 2)
+    {
+        cerr << "Usage: " << argv[0] << ' ' << argv[1] << " <count> [classes]" << endl;
+        exit(1);
+    }
+
+    return stoul(argv[2]);
+}
+
+// Every refinement gets written as a block of the current best candidates
+static void write_top_purges(const model& m, size_t k, int argc, const char** argv)
+{
+    auto start = std::chrono::system_clock::now();
+    PurgeDominance d(m.adj);
+    vector<PurgeCandidate> candidates = purge_candidates(m, d, argc, argv);
+
+    search_top_purges(d, candidates, k, [&](span<const RankedPurge> best, size_t n_processed)
+    {
+        cout << "--- " << n_processed << '/' << candidates.size() << '\n';
+        for(const RankedPurge& p : best)
+            cout << candidates[p.candidate].name << ": " << p.gain << '\n';
+        cout.flush();
+    });
+
+    auto end = std::chrono::system_clock::now();
+    std::chrono::duration<double> elapsed_seconds = end-start;
+    cerr << elapsed_seconds.count() << " s" << endl;
+}
+
+static void write_greedy_purge_set(const model& m, size_t budget, int argc, const char** argv)
+{
+    PurgeDominance d(m.adj);
+    vector<PurgeCandidate> candidates = purge_candidates(m, d, argc, argv);
+    uint64_t total = 0;
+
+    greedy_purge_set(d, candidates, budget, [&](const RankedPurge& pick)
+    {
+        total += pick.gain;
+        cout << candidates[pick.candidate].name << ": " << pick.gain << " (" << total << ')' << endl;
+    });
+}
+
+static void show_data_info(model& m)
+{
+    {
+        size_t singleton_filter_count = std::count_if(m.adj.flows.begin(), m.adj.flows.end(), [](const auto& f){ return f.filter.count() == 1; });
+        cout << "singleton_filter: " << (100.0 * singleton_filter_count / m.adj.n_typeflows()) << endl;
+    }
+
+    BFS<true> res = BFS<true>::run(m.adj);
+
+    {
+        size_t singleton_filter_count = 0;
+        for(size_t i = 0; i < m.adj.n_typeflows(); i++)
+            singleton_filter_count += res.typeflow_visited[i].any() && m.adj.flows[i].filter.count() == 1;
+        size_t all_count = std::count_if(res.typeflow_visited.begin(), res.typeflow_visited.end(), [](const auto& h){ return h.any(); });
+        cout << "singleton_filter for reachable nodes: " << (100.0 * singleton_filter_count / all_count) << endl;
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    model m(read_model_data());
+    m.optimize();
 
     string_view command = argv[1];
 
@@ -462,6 +1006,52 @@ int main(int argc, const char** argv)
         iostream::sync_with_stdio(false);
         compute_and_write_purge_matrix(m, cout);
     }
+    else if(command == "purge_matrix_sparse")
+    {
+        compute_and_write_sparse_purge_matrix(m, cout, argc > 2 && string_view(argv[2]) == "transposed");
+    }
+    else if(command == "purge_matrix_rows")
+    {
+        if(argc <= 2)
+        {
+            cerr << "Usage: " << argv[0] << " purge_matrix_rows <sparse purge matrix file>" << endl;
+            exit(1);
+        }
+
+        iostream::sync_with_stdio(false);
+        print_sparse_purge_matrix_rows(m, argv[2]);
+    }
+    else if(command == "purge_gains")
+    {
+        iostream::sync_with_stdio(false);
+        write_purge_gains(m, cout);
+    }
+    else if(command == "edge_gains")
+    {
+        iostream::sync_with_stdio(false);
+        write_edge_purge_gains(m);
+    }
+    else if(command == "top_k")
+    {
+        iostream::sync_with_stdio(false);
+        write_top_purges(m, parse_count_argument(argc, argv), argc, argv);
+    }
+    else if(command == "greedy_purge")
+    {
+        write_greedy_purge_set(m, parse_count_argument(argc, argv), argc, argv);
+    }
+    else if(command == "check_purge_gains_correctness")
+    {
+        check_with_type_costs(m, check_purge_gains_correctness);
+    }
+    else if(command == "check_incremental_correctness")
+    {
+        check_with_type_costs(m, check_incremental_correctness);
+    }
+    else if(command == "check_edge_purge_gains_correctness")
+    {
+        check_with_type_costs(m, check_edge_purge_gains_correctness);
+    }
     else
     {
         simulate_purge(m.adj, m.method_names, m.method_ids_by_name, command);
@@ -1,29 +1,35 @@
 #ifndef CAUSALITY_GRAPH_BITSET_H
 #define CAUSALITY_GRAPH_BITSET_H
 
-#include <vector>
-#include <iostream>
+#include <cstdint>
+#include <cstdlib>
 #include <bit>
+#include <limits>
+#include <algorithm>
+#include <span>
 
+/* Fixed-size set of bits, referring to blocks owned elsewhere.
+ * The typestates all live in one contiguous buffer with a row of words per typestate, see read_typestate_bitsets. */
 class Bitset
 {
+public:
     using block_t = uint64_t;
     static constexpr size_t bits_per_block = sizeof(block_t) * 8;
 
-    std::vector<block_t> blocks;
+    static constexpr size_t blocks_for(size_t len)
+    {
+        return (len + (bits_per_block - 1)) / bits_per_block;
+    }
+
+private:
+    std::span<const block_t> blocks;
     size_t len;
-    size_t _count;
+    size_t _count = 0;
 
 public:
-    Bitset(size_t len) : len(len), blocks((len + (bits_per_block - 1)) / bits_per_block)
-    {}
-
-    void fill(std::istream& src)
+    Bitset(const block_t* blocks, size_t len) : blocks(blocks, blocks_for(len)), len(len)
     {
-        src.read((char*)blocks.data(), (len + 7) / 8);
-
-        _count = 0;
-        for(block_t block : blocks)
+        for(block_t block : this->blocks)
             _count += std::popcount(block);
     }
 
@@ -91,7 +97,7 @@ public:
     bool operator==(const Bitset& other) const
     {
         // Based on the assumption that the unused leftmost bits are always zero
-        return blocks == other.blocks;
+        return len == other.len && std::equal(blocks.begin(), blocks.end(), other.blocks.begin());
     }
 };
 
@@ -6,34 +6,67 @@
 #include <array>
 #include <stack>
 #include <functional>
+#include <atomic>
+#include "simd.h"
 
 using namespace std;
 
-struct __attribute__((aligned(64))) TypeflowHistory
+/* Types that reached a typeflow, in order of arrival.
+ * The dist-free variant is used by BFS<false>, which never reads the dists, and thus only needs 48 instead of 64 bytes. */
+template<bool with_dists>
+struct __attribute__((aligned(with_dists ? 64 : 16))) BasicTypeflowHistory
 {
     static constexpr size_t saturation_cutoff = 20;
 
+    struct no_dists {};
+
     type_t types[saturation_cutoff];
-    uint8_t dists[saturation_cutoff];
+    [[no_unique_address]] conditional_t<with_dists, uint8_t[saturation_cutoff], no_dists> dists;
     uint8_t saturated_dist = numeric_limits<uint8_t>::max();
+    // Number of leading types that already got propagated to the successors of the typeflow
+    uint8_t n_propagated = 0;
 
 public:
-    TypeflowHistory()
+    BasicTypeflowHistory()
     {
         fill(types, types + saturation_cutoff, numeric_limits<type_t>::max());
-        fill(dists, dists + saturation_cutoff, numeric_limits<uint8_t>::max());
+        if constexpr(with_dists)
+            fill(dists, dists + saturation_cutoff, numeric_limits<uint8_t>::max());
     }
 
 
+#if CAUSALITY_SIMD
+    // Bit i is set if types[i] is a or b. The kernel reads 48 bytes, which stays within the history in both variants.
+    [[nodiscard]] uint32_t slots_of(type_t a, type_t b) const
+    {
+        return match_u16x24(types, a, b) & ((uint32_t(1) << saturation_cutoff) - 1);
+    }
+#endif
+
 public:
     bool add_type(type_t type, uint8_t dist)
     {
+#if CAUSALITY_SIMD
+        // Types occupy a prefix of the slots, so the first slot that is either free or holds the type decides
+        if(uint32_t slots = slots_of(type, numeric_limits<type_t>::max()))
+        {
+            size_t i = std::countr_zero(slots);
+            if(types[i] == type)
+                return false;
+
+            types[i] = type;
+            if constexpr(with_dists)
+                dists[i] = dist;
+            return true;
+        }
+#else
         for(size_t i = 0; i < saturation_cutoff; i++)
         {
             if(types[i] == numeric_limits<type_t>::max())
             {
                 types[i] = type;
-                dists[i] = dist;
+                if constexpr(with_dists)
+                    dists[i] = dist;
                 return true;
             }
             else if(types[i] == type)
@@ -41,6 +74,7 @@ public:
                 return false;
             }
         }
+#endif
 
         saturated_dist = dist;
         return true;
@@ -50,10 +84,10 @@ public:
     {
         struct end_it{};
 
-        const TypeflowHistory* parent;
+        const BasicTypeflowHistory* parent;
         size_t pos;
 
-        iterator(const TypeflowHistory* parent) : parent(parent), pos(0) {}
+        iterator(const BasicTypeflowHistory* parent) : parent(parent), pos(0) {}
 
         bool operator==(end_it e) const
         {
@@ -62,7 +96,10 @@ public:
 
         pair<type_t, uint8_t> operator*() const
         {
-            return {parent->types[pos], parent->dists[pos]};
+            if constexpr(with_dists)
+                return {parent->types[pos], parent->dists[pos]};
+            else
+                return {parent->types[pos], 0};
         }
 
         void operator++()
@@ -73,7 +110,51 @@ public:
 
     iterator begin() const { return { this }; }
 
-    iterator::end_it end() const { return {}; }
+    typename iterator::end_it end() const { return {}; }
+
+    // Types that arrived since the last call to mark_propagated()
+    struct unpropagated_range
+    {
+        const BasicTypeflowHistory* parent;
+
+        iterator begin() const
+        {
+            iterator it(parent);
+            it.pos = parent->n_propagated;
+            return it;
+        }
+
+        typename iterator::end_it end() const { return {}; }
+    };
+
+    unpropagated_range unpropagated() const { return { this }; }
+
+    void mark_propagated()
+    {
+        n_propagated = count();
+    }
+
+    // Since histories only grow, this suffices to restore an earlier state
+    struct Snapshot
+    {
+        uint8_t count;
+        uint8_t saturated_dist;
+        uint8_t n_propagated;
+    };
+
+    Snapshot snapshot() const
+    {
+        return {(uint8_t)count(), saturated_dist, n_propagated};
+    }
+
+    void restore(Snapshot s)
+    {
+        fill(types + s.count, types + saturation_cutoff, numeric_limits<type_t>::max());
+        if constexpr(with_dists)
+            fill(dists + s.count, dists + saturation_cutoff, numeric_limits<uint8_t>::max());
+        saturated_dist = s.saturated_dist;
+        n_propagated = s.n_propagated;
+    }
 
     bool is_saturated() const
     {
@@ -87,21 +168,40 @@ public:
 
     size_t count() const
     {
+#if CAUSALITY_SIMD
+        uint32_t free = slots_of(numeric_limits<type_t>::max(), numeric_limits<type_t>::max());
+        return free ? std::countr_zero(free) : saturation_cutoff;
+#else
         size_t c = 0;
         for(auto tmp : *this)
             c++;
         return c;
+#endif
+    }
+
+    // Slot of t, or saturation_cutoff if it is not in the history
+    [[nodiscard]] size_t slot(type_t t) const
+    {
+#if CAUSALITY_SIMD
+        uint32_t match = slots_of(t, t);
+        return match ? std::countr_zero(match) : saturation_cutoff;
+#else
+        size_t i = 0;
+        while(i < saturation_cutoff && types[i] != t)
+            i++;
+        return i;
+#endif
     }
 
     bool contains(type_t t) const
     {
-        for(auto tmp : *this)
-            if(tmp.first == t)
-                return true;
-        return false;
+        return slot(t) != saturation_cutoff;
     }
 };
 
+using TypeflowHistory = BasicTypeflowHistory<true>;
+using CompactTypeflowHistory = BasicTypeflowHistory<false>;
+
 static_assert(std::is_trivially_copyable<TypeflowHistory>::value);
 static_assert(std::is_trivially_assignable<TypeflowHistory, TypeflowHistory>::value);
 static_assert(std::is_trivially_copy_assignable<TypeflowHistory>::value);
@@ -112,152 +212,768 @@ static_assert(std::is_trivially_destructible<TypeflowHistory>::value);
 //static_assert(std::is_trivial<TypeflowHistory>::value);
 static_assert(sizeof(TypeflowHistory) == 64);
 
-class DefaultMethodHistory
+static_assert(std::is_trivially_copyable<CompactTypeflowHistory>::value);
+static_assert(std::is_trivially_destructible<CompactTypeflowHistory>::value);
+static_assert(sizeof(CompactTypeflowHistory) == 48);
+
+/* Per-method state of a BFS.
+ * The visited and inhibited bits of 64 consecutive methods are interleaved in one 16-byte block,
+ * such that the hot loops find both in the same cache line. Dists are only stored if they matter. */
+template<bool with_dists>
+class MethodStates
 {
 public:
-    uint8_t dist = numeric_limits<decltype(dist)>::max();
+    static constexpr uint8_t unreachable = numeric_limits<uint8_t>::max();
+    static constexpr size_t methods_per_block = 64;
 
-    explicit DefaultMethodHistory(uint8_t dist) : dist(dist) {}
-    DefaultMethodHistory() = default;
+    struct Block
+    {
+        // Methods that got reached
+        uint64_t visited = 0;
+        // Methods that got reached, scheduled or purged, and therefore must not be scheduled again
+        uint64_t inhibited = 0;
+    };
+
+private:
+    struct no_dists {};
+
+    vector<Block> blocks;
+    [[no_unique_address]] conditional_t<with_dists, vector<uint8_t>, no_dists> dists;
+    size_t n_methods;
+
+    static uint64_t mask(method_id m) { return uint64_t(1) << (m.id % methods_per_block); }
 
-    explicit operator bool() const
+    Block& block(method_id m) { return blocks[m.id / methods_per_block]; }
+
+    const Block& block(method_id m) const { return blocks[m.id / methods_per_block]; }
+
+public:
+    explicit MethodStates(size_t n_methods) : blocks((n_methods + methods_per_block - 1) / methods_per_block), n_methods(n_methods)
     {
-        return dist != numeric_limits<decltype(dist)>::max();
+        if constexpr(with_dists)
+            dists.resize(n_methods, unreachable);
+    }
+
+    [[nodiscard]] size_t size() const { return n_methods; }
+
+    [[nodiscard]] size_t used_memory_size() const
+    {
+        size_t size = blocks.capacity() * sizeof(Block);
+        if constexpr(with_dists)
+            size += dists.capacity();
+        return size;
+    }
+
+    [[nodiscard]] bool visited(method_id m) const { return block(m).visited & mask(m); }
+
+    [[nodiscard]] bool inhibited(method_id m) const { return block(m).inhibited & mask(m); }
+
+    // Returns whether the method was not inhibited before
+    bool inhibit(method_id m)
+    {
+        Block& b = block(m);
+        bool was_inhibited = b.inhibited & mask(m);
+        b.inhibited |= mask(m);
+        return !was_inhibited;
+    }
+
+    void uninhibit(method_id m) { block(m).inhibited &= ~mask(m); }
+
+    void visit(method_id m, uint8_t dist)
+    {
+        block(m).visited |= mask(m);
+        if constexpr(with_dists)
+            dists[m.id] = dist;
+    }
+
+    // Forgets both the visit and the inhibition
+    void reset(method_id m)
+    {
+        Block& b = block(m);
+        b.visited &= ~mask(m);
+        b.inhibited &= ~mask(m);
+        if constexpr(with_dists)
+            dists[m.id] = unreachable;
+    }
+
+    void clear()
+    {
+        std::fill(blocks.begin(), blocks.end(), Block());
+        if constexpr(with_dists)
+            std::fill(dists.begin(), dists.end(), unreachable);
+    }
+
+    // Without stored dists, every visited method has dist zero
+    [[nodiscard]] uint8_t dist(method_id m) const
+    {
+        if constexpr(with_dists)
+            return dists[m.id];
+        else
+            return visited(m) ? 0 : unreachable;
+    }
+
+    [[nodiscard]] size_t count_visited() const
+    {
+        size_t c = 0;
+        for(const Block& b : blocks)
+            c += std::popcount(b.visited);
+        return c;
+    }
+
+    [[nodiscard]] size_t count_inhibited() const
+    {
+        size_t c = 0;
+        for(const Block& b : blocks)
+            c += std::popcount(b.inhibited);
+        return c;
+    }
+
+    // One byte per method, containing its dist or 'unreachable'
+    void write_dists(uint8_t* dst) const
+    {
+        if constexpr(with_dists)
+        {
+            std::copy(dists.begin(), dists.end(), dst);
+        }
+        else
+        {
+            for(size_t i = 0; i < n_methods; i++)
+                dst[i] = dist(i);
+        }
+    }
+
+    [[nodiscard]] span<const uint8_t> dist_bytes() const requires with_dists { return dists; }
+
+    [[nodiscard]] span<const Block> packed() const { return blocks; }
+
+    // Visited bits of 64 methods per word, to compare other states against with for_each_lost()
+    [[nodiscard]] vector<uint64_t> visited_words() const
+    {
+        vector<uint64_t> words;
+        words.reserve(blocks.size());
+        for(const Block& b : blocks)
+            words.push_back(b.visited);
+        return words;
+    }
+
+    // Calls f(method_id) in ascending order for the methods visited according to the given words, but not here
+    template<typename F>
+    void for_each_lost(span<const uint64_t> visited_before, F&& f) const
+    {
+        assert(visited_before.size() == blocks.size());
+
+        for(size_t i = 0; i < blocks.size(); i++)
+            for(uint64_t lost = visited_before[i] & ~blocks[i].visited; lost; lost &= lost - 1)
+                f(method_id(i * methods_per_block + std::countr_zero(lost)));
     }
 };
 
+static_assert(sizeof(MethodStates<true>::Block) == 16);
 
-class BFS
+// Bitset with direct word access instead of the proxy references of vector<bool>
+class FlagSet
+{
+    vector<uint64_t> words;
+
+public:
+    explicit FlagSet(size_t n) : words((n + 63) / 64) {}
+
+    bool operator[](size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+
+    void set(size_t i) { words[i / 64] |= uint64_t(1) << (i % 64); }
+
+    void reset(size_t i) { words[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+
+    void clear() { std::fill(words.begin(), words.end(), 0); }
+
+    [[nodiscard]] size_t used_memory_size() const { return words.capacity() * sizeof(uint64_t); }
+};
+
+
+// Set of filter ids with O(1) insertion, removal and lookup
+class FilterSet
 {
+    static constexpr uint32_t absent = numeric_limits<uint32_t>::max();
+
+    vector<uint32_t> filters;
+    vector<uint32_t> positions;
+
 public:
-    struct ResultDiff
-    {
-        vector<method_id> visited_method_log;
-        vector<hyperedge_id> visited_hyperedge_log;
-        vector<pair<typeflow_id, TypeflowHistory>> typeflow_visited_log;
-        vector<type_t> allInstantiated_log;
-        vector<typeflow_id> included_in_saturation_uses_log;
-        vector<typeflow_id> saturation_uses_by_filter_added_log;
-        vector<typeflow_id> saturation_uses_by_filter_removed_log;
-
-        ResultDiff(vector<method_id>&& visited_method_log,
-                   vector<hyperedge_id>&& visited_hyperedge_log,
-                   vector<pair<typeflow_id, TypeflowHistory>>&& typeflow_visited_log,
-                   vector<type_t>&& allInstantiated_log,
-                   vector<typeflow_id>&& included_in_saturation_uses_log,
-                   vector<typeflow_id>&& saturation_uses_by_filter_added_log,
-                   vector<typeflow_id>&& saturation_uses_by_filter_removed_log)
-                : visited_method_log(std::move(visited_method_log)),
-                  visited_hyperedge_log(std::move(visited_hyperedge_log)),
-                  typeflow_visited_log(std::move(typeflow_visited_log)),
-                  allInstantiated_log(std::move(allInstantiated_log)),
-                  included_in_saturation_uses_log(std::move(included_in_saturation_uses_log)),
-                  saturation_uses_by_filter_added_log(std::move(saturation_uses_by_filter_added_log)),
-                  saturation_uses_by_filter_removed_log(std::move(saturation_uses_by_filter_removed_log))
-        {
-#if LOG
-            size_t complete_size = 0;
-            complete_size += this->visited_method_log.capacity() * sizeof(method_id);
-            complete_size += this->typeflow_visited_log.capacity() * sizeof(pair<typeflow_id, TypeflowHistory>);
-            complete_size += this->allInstantiated_log.capacity() * sizeof(type_t);
-            complete_size += this->included_in_saturation_uses_log.capacity() * sizeof(typeflow_id);
-            complete_size += this->saturation_uses_by_filter_added_log.capacity() * sizeof(typeflow_id);
-            complete_size += this->saturation_uses_by_filter_removed_log.capacity() * sizeof(typeflow_id);
-            cerr << "ResultDiff size: " << complete_size << endl;
-#endif
+    explicit FilterSet(size_t n_filters) : positions(n_filters, absent) {}
+
+    void insert(uint32_t filter_id)
+    {
+        if(positions[filter_id] != absent)
+            return;
+
+        positions[filter_id] = filters.size();
+        filters.push_back(filter_id);
+    }
+
+    void erase(uint32_t filter_id)
+    {
+        uint32_t pos = positions[filter_id];
+
+        if(pos == absent)
+            return;
+
+        uint32_t last = filters.back();
+        filters[pos] = last;
+        positions[last] = pos;
+        filters.pop_back();
+        positions[filter_id] = absent;
+    }
+
+    [[nodiscard]] bool contains(uint32_t filter_id) const
+    {
+        return positions[filter_id] != absent;
+    }
+
+    void clear()
+    {
+        for(uint32_t filter_id : filters)
+            positions[filter_id] = absent;
+        filters.clear();
+    }
+
+    [[nodiscard]] size_t size() const { return filters.size(); }
+
+    [[nodiscard]] size_t used_memory_size() const { return (filters.capacity() + positions.capacity()) * sizeof(uint32_t); }
+
+    [[nodiscard]] auto begin() const { return filters.begin(); }
+
+    [[nodiscard]] auto end() const { return filters.end(); }
+};
+
+/* Edges that are masked on top of the immutable Adjacency, for simulating their removal without rebuilding the model.
+ * Calls and interflows are identified by their endpoints, which masks all parallel edges alike,
+ * hyperedges by their id. Masks are expected to be few, so per source only a flag is kept for the fast path. */
+class EdgeOverlay
+{
+    vector<Edge<method_id>> calls;
+    vector<Edge<typeflow_id>> interflows;
+    FlagSet call_sources;
+    FlagSet interflow_sources;
+    FlagSet hyperedges;
+
+    template<typename Id>
+    static void erase_edge(vector<Edge<Id>>& edges, FlagSet& sources, Edge<Id> e)
+    {
+        auto it = std::find_if(edges.begin(), edges.end(), [&](Edge<Id> other) { return other.src == e.src && other.dst == e.dst; });
+
+        if(it == edges.end())
+            return;
+
+        edges.erase(it);
+
+        if(std::none_of(edges.begin(), edges.end(), [&](Edge<Id> other) { return other.src == e.src; }))
+            sources.reset(e.src.id);
+    }
+
+    template<typename Id>
+    static bool contains_edge(const vector<Edge<Id>>& edges, Id src, Id dst)
+    {
+        return std::any_of(edges.begin(), edges.end(), [&](Edge<Id> e) { return e.src == src && e.dst == dst; });
+    }
+
+public:
+    explicit EdgeOverlay(const Adjacency& adj) : call_sources(adj.n_methods()), interflow_sources(adj.n_typeflows()), hyperedges(adj.n_hyperedges()) {}
+
+    void mask(Edge<method_id> e)
+    {
+        if(!masked(e.src, e.dst))
+        {
+            calls.push_back(e);
+            call_sources.set(e.src.id);
+        }
+    }
+
+    void mask(Edge<typeflow_id> e)
+    {
+        if(!masked(e.src, e.dst))
+        {
+            interflows.push_back(e);
+            interflow_sources.set(e.src.id);
+        }
+    }
+
+    void mask(hyperedge_id he) { hyperedges.set(he.id); }
+
+    void unmask(Edge<method_id> e) { erase_edge(calls, call_sources, e); }
+
+    void unmask(Edge<typeflow_id> e) { erase_edge(interflows, interflow_sources, e); }
+
+    void unmask(hyperedge_id he) { hyperedges.reset(he.id); }
+
+    void clear()
+    {
+        calls.clear();
+        interflows.clear();
+        call_sources.clear();
+        interflow_sources.clear();
+        hyperedges.clear();
+    }
+
+    [[nodiscard]] bool masks_calls_from(method_id u) const { return call_sources[u.id]; }
+
+    [[nodiscard]] bool masks_interflows_from(typeflow_id u) const { return interflow_sources[u.id]; }
+
+    [[nodiscard]] bool masked(method_id u, method_id v) const { return call_sources[u.id] && contains_edge(calls, u, v); }
+
+    [[nodiscard]] bool masked(typeflow_id u, typeflow_id v) const { return interflow_sources[u.id] && contains_edge(interflows, u, v); }
+
+    [[nodiscard]] bool masked(hyperedge_id he) const { return hyperedges[he.id]; }
+};
+
+enum class EdgeMasking
+{
+    masked,
+    // Some edge got merged with others by model::optimize(), so its removal can't be simulated
+    contracted,
+    // Some edge instantiates types with costs, which the overlay can't take back
+    instantiating,
+    // Some index lies outside of the input edges
+    out_of_range,
+};
+
+/* Masks the given edges of the Adjacency, sorting them in the process.
+ * Parallel copies are counted, since the edge only goes away once all of them are given. */
+template<typename Id>
+static void mask_unless_copy_remains(EdgeOverlay& overlay, const Adjacency& adj, vector<Edge<Id>>& edges)
+{
+    auto less = [](Edge<Id> a, Edge<Id> b) { return pair(a.src.id, a.dst.id) < pair(b.src.id, b.dst.id); };
+    std::sort(edges.begin(), edges.end(), less);
+
+    for(auto copies_begin = edges.begin(); copies_begin != edges.end();)
+    {
+        auto copies_end = std::upper_bound(copies_begin, edges.end(), *copies_begin, less);
+        const auto& successors = adj[copies_begin->src].forward_edges;
+
+        if((size_t)(copies_end - copies_begin) >= (size_t)std::count(successors.begin(), successors.end(), copies_begin->dst))
+            overlay.mask(*copies_begin);
+
+        copies_begin = copies_end;
+    }
+}
+
+// Masks edges given by their index in the input. Nothing gets masked if some index is out of range.
+static EdgeMasking mask_input_edges(EdgeOverlay& overlay, const model& m, span<const uint32_t> direct_invokes, span<const uint32_t> interflows, span<const uint32_t> hyperedges)
+{
+    auto beyond = [](span<const uint32_t> indices, size_t n) { return std::any_of(indices.begin(), indices.end(), [n](uint32_t index) { return index >= n; }); };
+
+    if(beyond(direct_invokes, m.direct_invokes.size()) || beyond(interflows, m.interflows.size()) || beyond(hyperedges, m.adj.n_hyperedges()))
+        return EdgeMasking::out_of_range;
+
+    // Each copy of an edge counts once, however often it is given
+    auto distinct = [](span<const uint32_t> indices)
+    {
+        vector<uint32_t> sorted(indices.begin(), indices.end());
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+        return sorted;
+    };
+
+    vector<Edge<method_id>> calls;
+    for(uint32_t index : distinct(direct_invokes))
+        calls.push_back(m.resolve_direct_invoke(index).edge);
+
+    vector<Edge<typeflow_id>> flows;
+    for(uint32_t index : distinct(interflows))
+    {
+        auto e = m.resolve_interflow(index);
+        if(e.kind == ResolvedEdge<typeflow_id>::Kind::contracted)
+            return EdgeMasking::contracted;
+        if(e.kind == ResolvedEdge<typeflow_id>::Kind::instantiating)
+            return EdgeMasking::instantiating;
+        if(e.kind == ResolvedEdge<typeflow_id>::Kind::present)
+            flows.push_back(e.edge);
+    }
+
+    mask_unless_copy_remains(overlay, m.adj, calls);
+    mask_unless_copy_remains(overlay, m.adj, flows);
+
+    // Hyperedges are left untouched by the optimization
+    for(uint32_t index : hyperedges)
+        overlay.mask(hyperedge_id(index));
+
+    return EdgeMasking::masked;
+}
+
+/* Undo log of BFS runs, as a flat sequence of compact records.
+ * Runs only ever append to it, so nested runs are marked by offsets and reverted by unwinding back to them.
+ * The storage is kept when unwinding, such that subsequent runs don't allocate anymore. */
+class UndoJournal
+{
+public:
+    enum class Kind : uint32_t
+    {
+        visited_method,
+        visited_hyperedge,
+        typeflow,
+        instantiated_type,
+        included_in_saturation_uses,
+        saturation_use_added,
+        saturation_use_removed,
+    };
+
+private:
+    static constexpr uint32_t kind_bits = 3;
+
+    // Each record ends with a word holding its kind and id.
+    // Typeflow records are preceded by a word holding the snapshot of the history.
+    vector<uint32_t> words;
+
+public:
+    [[nodiscard]] size_t size() const { return words.size(); }
+
+    void push(Kind kind, uint32_t id)
+    {
+        assert(id < (uint32_t(1) << (32 - kind_bits)));
+        words.push_back((id << kind_bits) | (uint32_t)kind);
+    }
+
+    template<typename Snapshot>
+    void push_typeflow(typeflow_id v, Snapshot before)
+    {
+        words.push_back(before.count | (uint32_t(before.saturated_dist) << 8) | (uint32_t(before.n_propagated) << 16));
+        push(Kind::typeflow, v.id);
+    }
+
+    // Calls f(kind, id, snapshot_word) for all records after the given offset, newest first, and removes them
+    template<typename F>
+    void unwind(size_t offset, F&& f)
+    {
+        size_t pos = words.size();
+
+        while(pos > offset)
+        {
+            uint32_t word = words[--pos];
+            auto kind = (Kind)(word & ((uint32_t(1) << kind_bits) - 1));
+            uint32_t id = word >> kind_bits;
+            uint32_t snapshot_word = kind == Kind::typeflow ? words[--pos] : 0;
+            f(kind, id, snapshot_word);
         }
 
-        ResultDiff() = default;
+        words.resize(offset);
+    }
+};
+
+/* Causes of reachability, recorded by a BFS at the moment something first gets reached.
+ * Following them from a method leads back to the root, which makes explanations a walk through the records.
+ * Records of everything unreached are meaningless, they get overwritten on reaching instead of being reset. */
+class PredecessorRecords
+{
+public:
+    struct Method
+    {
+        enum class Kind : uint8_t
+        {
+            root,
+            call,
+            hyperedge,
+            typeflow,
+        };
+
+        Kind kind = Kind::root;
+        // For Kind::typeflow, the type in the typeflow that made the method reachable
+        type_t type = 0;
+        // Calling method, hyperedge or typeflow, depending on the kind
+        uint32_t id = 0;
     };
 
-    vector<TypeflowHistory> typeflow_visited;
-    vector<DefaultMethodHistory> method_history;
-    vector<bool> method_inhibited;
+    // Source of types that got into a typeflow because they were in allInstantiated
+    static constexpr uint32_t from_all_instantiated = numeric_limits<uint32_t>::max();
+
+private:
+    static constexpr size_t saturation_cutoff = TypeflowHistory::saturation_cutoff;
+
+    vector<Method> methods;
+    // Per typeflow and slot of its history, the typeflow the type came from. 0 stands for the white hole.
+    vector<typeflow_id> typeflow_type_sources;
+    // Per instantiated type, the typeflow that put it into allInstantiated
+    vector<typeflow_id> instantiation_sources;
+    // Per saturation use, the saturated typeflow that made it one
+    vector<typeflow_id> saturation_sources;
+
+public:
+    PredecessorRecords(size_t n_methods, size_t n_typeflows, size_t n_types) :
+        methods(n_methods),
+        typeflow_type_sources(n_typeflows * saturation_cutoff),
+        instantiation_sources(n_types),
+        saturation_sources(n_typeflows)
+    {}
+
+    void method(method_id m, Method cause) { methods[m.id] = cause; }
+
+    [[nodiscard]] Method method(method_id m) const { return methods[m.id]; }
+
+    void typeflow_type(const TypeflowHistory& history, typeflow_id v, type_t t, typeflow_id source)
+    {
+        size_t i = history.slot(t);
+        if(i != saturation_cutoff)
+            typeflow_type_sources[v.id * saturation_cutoff + i] = source;
+    }
+
+    // Where t in v came from, t has to be in the history of v
+    [[nodiscard]] typeflow_id typeflow_type(const TypeflowHistory& history, typeflow_id v, type_t t) const
+    {
+        return typeflow_type_sources[v.id * saturation_cutoff + history.slot(t)];
+    }
+
+    void instantiation(type_t t, typeflow_id source) { instantiation_sources[t] = source; }
+
+    [[nodiscard]] typeflow_id instantiation(type_t t) const { return instantiation_sources[t]; }
+
+    void saturation_use(typeflow_id v, typeflow_id source) { saturation_sources[v.id] = source; }
+
+    // Why v gets the instantiated types, only meaningful if some type got into v from allInstantiated
+    [[nodiscard]] typeflow_id saturation_use(typeflow_id v) const { return saturation_sources[v.id]; }
+};
+
+/* If dist_matters is asigned false, the BFS gets sped up about x2.
+ * However, all dist-values of types in typeflows and methods will be zero. */
+template<bool dist_matters>
+class BFS
+{
+public:
+    using History = BasicTypeflowHistory<dist_matters>;
+
+    vector<History> typeflow_visited;
+    MethodStates<dist_matters> methods;
     vector<bool> allInstantiated;
+    // Per type, the number of visited methods that instantiate it, see Adjacency::MethodInfo::instantiated_types
+    vector<uint32_t> type_instantiations;
     vector<vector<typeflow_id>> saturation_uses_by_filter;
+    // Filters whose saturation_uses_by_filter entry is non-empty
+    FilterSet active_filters;
     vector<bool> included_in_saturation_uses;
-    vector<bool> hyperedge_visited_atleast_once;
+    FlagSet hyperedge_visited_atleast_once;
+    // Marks typeflows that currently sit in the worklist. All false between runs.
+    vector<bool> typeflow_pending;
+    // Marks the methods of the current level while it gets expanded bottom-up. All false between runs.
+    vector<bool> method_frontier;
+    // Scratch space of revert()
+    vector<typeflow_id> reverted_saturation_uses;
+    vector<typeflow_id> reverted_additions;
+    // Sum of the costs of the visited methods and of the types they instantiate.
+    // The PurgeGain of a purge set is the difference of this between the unpurged and the purged fixpoint.
+    uint64_t reached_cost = 0;
+    // Edges that get ignored by run() and has_reached_predecessor(), if set
+    const EdgeOverlay* overlay = nullptr;
+    // Makes run() stop after the current method level once set, possibly by another thread
+    const atomic<bool>* cancel = nullptr;
+
+    struct no_predecessors
+    {
+        no_predecessors(size_t, size_t, size_t) {}
+    };
+
+    // Only recorded if dist_matters, for explaining the reachability afterwards
+    [[no_unique_address]] conditional_t<dist_matters, PredecessorRecords, no_predecessors> predecessors;
+
+    struct Stats
+    {
+        size_t typeflow_pops = 0;
+        // Pushes of typeflows that were still pending and therefore got merged into the pending entry
+        size_t typeflow_pushes_deduplicated = 0;
+        size_t method_levels = 0;
+        size_t method_levels_bottom_up = 0;
+        size_t method_visits = 0;
+    } stats;
+
+    // Lets a run stop as soon as all of these methods got reached
+    struct Targets
+    {
+        FlagSet marks;
+        size_t n_unreached = 0;
+
+        Targets(size_t n_methods, span<const method_id> targets) : marks(n_methods)
+        {
+            for(method_id m : targets)
+            {
+                if(!marks[m.id])
+                {
+                    marks.set(m.id);
+                    n_unreached++;
+                }
+            }
+        }
+    };
+
+    // Thresholds for switching between top-down and bottom-up expansion of the method frontier,
+    // as proposed by Beamer et al. for direction-optimizing BFS
+    static constexpr size_t bottom_up_alpha = 14;
+    static constexpr size_t bottom_up_beta = 24;
 
     BFS(size_t n_methods, size_t n_typeflows, size_t n_types, size_t n_filters, size_t n_hyperedges) :
         typeflow_visited(n_typeflows),
-        method_inhibited(n_methods),
-        method_history(n_methods),
+        methods(n_methods),
         allInstantiated(n_types),
+        type_instantiations(n_types),
         saturation_uses_by_filter(n_filters),
+        active_filters(n_filters),
         included_in_saturation_uses(n_typeflows),
-        hyperedge_visited_atleast_once(n_hyperedges)
+        hyperedge_visited_atleast_once(n_hyperedges),
+        typeflow_pending(n_typeflows),
+        method_frontier(n_methods),
+        predecessors(n_methods, n_typeflows, n_types)
     {}
 
     explicit BFS(const Adjacency& adj) : BFS(adj.n_methods(), adj.n_typeflows(), adj.n_types(), adj.filter_filters.size(), adj.n_hyperedges())
     {}
 
-    /* If dist_matters is asigned false, the BFS gets sped up about x2.
-     * However, all dist-values of types in typeflows and methods will be zero. */
-    template<bool dist_matters = true>
-    [[nodiscard]] static BFS run(const Adjacency& adj, span<const method_id> purged_methods = {})
+    // Brings the state back to the one of a freshly constructed BFS, while keeping all allocations
+    void clear()
+    {
+        std::fill(typeflow_visited.begin(), typeflow_visited.end(), History());
+        methods.clear();
+        std::fill(allInstantiated.begin(), allInstantiated.end(), false);
+        std::fill(type_instantiations.begin(), type_instantiations.end(), 0);
+        std::fill(included_in_saturation_uses.begin(), included_in_saturation_uses.end(), false);
+        hyperedge_visited_atleast_once.clear();
+
+        for(uint32_t filter_id : active_filters)
+            saturation_uses_by_filter[filter_id].clear();
+        active_filters.clear();
+
+        // run() unmarks these itself, also when it stops early
+        assert(std::none_of(typeflow_pending.begin(), typeflow_pending.end(), [](bool pending) { return pending; }));
+        assert(std::none_of(method_frontier.begin(), method_frontier.end(), [](bool frontier) { return frontier; }));
+
+        reached_cost = 0;
+        stats = {};
+    }
+
+    // Memory held by the state, without the predecessor records
+    [[nodiscard]] size_t used_memory_size() const
+    {
+        auto bits_size = [](const vector<bool>& bits) { return (bits.capacity() + 7) / 8; };
+
+        size_t size = sizeof(BFS);
+        size += typeflow_visited.capacity() * sizeof(History);
+        size += methods.used_memory_size();
+        size += bits_size(allInstantiated);
+        size += type_instantiations.capacity() * sizeof(uint32_t);
+        size += saturation_uses_by_filter.capacity() * sizeof(vector<typeflow_id>);
+        for(const auto& uses : saturation_uses_by_filter)
+            size += uses.capacity() * sizeof(typeflow_id);
+        size += active_filters.used_memory_size();
+        size += bits_size(included_in_saturation_uses);
+        size += hyperedge_visited_atleast_once.used_memory_size();
+        size += bits_size(typeflow_pending);
+        size += bits_size(method_frontier);
+        size += reverted_saturation_uses.capacity() * sizeof(typeflow_id);
+        size += reverted_additions.capacity() * sizeof(typeflow_id);
+        return size;
+    }
+
+    [[nodiscard]] static BFS run(const Adjacency& adj, span<const method_id> purged_methods = {}, const EdgeOverlay* overlay = nullptr, const atomic<bool>* cancel = nullptr)
     {
         BFS r(adj);
+        r.overlay = overlay;
+        r.cancel = cancel;
 
         for(method_id purged : purged_methods)
-            r.method_inhibited[purged.id] = true;
+            r.methods.inhibit(purged);
 
         method_id root_method = 0;
 
-        r.run<dist_matters>(adj, {&root_method, 1}, true);
+        r.run(adj, {&root_method, 1}, true);
 
         for(method_id purged : purged_methods)
-            r.method_inhibited[purged.id] = false;
+            r.methods.uninhibit(purged);
 
         return r;
     }
 
-    /* If dist_matters is asigned false, the BFS gets sped up about x2.
-     * However, all dist-values of types in typeflows and methods will be zero. */
-    template<bool dist_matters = true, bool track_changes = false>
-    auto run(const Adjacency& adj, span<const method_id> method_worklist_init, bool init_typeflows)
+    // With track_changes, all changes get recorded into the journal, such that they can be reverted.
+    // If targets are given, the run stops after the method level in which the last of them got reached.
+    // The state then only is a lower bound for the fixpoint, as it is after a cancelled run.
+    template<bool track_changes = false>
+    void run(const Adjacency& adj, span<const method_id> method_worklist_init, bool init_typeflows, UndoJournal* journal = nullptr, Targets* targets = nullptr)
     {
+        assert(!track_changes || journal);
+
         // Moving these into locals proved beneficial with the previous architecture, where the results were indirectly referenced
         // via BFS::Result.
         // TODO: Investigate if this is still necessary performance-wise
-        vector<bool> method_inhibited(std::move(this->method_inhibited));
-        vector<bool> hyperedge_visited_atleast_once(std::move(this->hyperedge_visited_atleast_once));
-        vector<DefaultMethodHistory> method_history(std::move(this->method_history));
-        vector<TypeflowHistory> typeflow_visited(std::move(this->typeflow_visited));
+        MethodStates<dist_matters> methods(std::move(this->methods));
+        FlagSet hyperedge_visited_atleast_once(std::move(this->hyperedge_visited_atleast_once));
+        vector<History> typeflow_visited(std::move(this->typeflow_visited));
         vector<bool> allInstantiated(std::move(this->allInstantiated));
         vector<vector<typeflow_id>> saturation_uses_by_filter(std::move(this->saturation_uses_by_filter));
+        FilterSet active_filters(std::move(this->active_filters));
         vector<bool> included_in_saturation_uses(std::move(this->included_in_saturation_uses));
-
-        vector<method_id> visited_method_log;
-        vector<hyperedge_id> visited_hyperedges_log;
-        vector<pair<typeflow_id, TypeflowHistory>> typeflow_visited_log;
-        vector<type_t> allInstantiated_log;
-        vector<typeflow_id> included_in_saturation_uses_log;
-        vector<typeflow_id> saturation_uses_by_filter_added_log;
-        vector<typeflow_id> saturation_uses_by_filter_removed_log;
+        vector<bool> typeflow_pending(std::move(this->typeflow_pending));
+        vector<bool> method_frontier(std::move(this->method_frontier));
+        const EdgeOverlay* overlay = this->overlay;
+        [[maybe_unused]] auto& predecessors = this->predecessors;
 
         for(method_id root : method_worklist_init)
         {
-            method_inhibited[root.id] = true;
-            method_history[root.id] = DefaultMethodHistory(0);
+            methods.inhibit(root);
+            methods.visit(root, 0);
+
+            if constexpr(dist_matters)
+                predecessors.method(root, {});
         }
 
         vector<method_id> method_worklist(method_worklist_init.begin(), method_worklist_init.end());
         vector<method_id> next_method_worklist;
         queue<typeflow_id> typeflow_worklist;
         vector<type_t> instantiated_since_last_iteration;
+        vector<uint32_t> filters_to_spread;
+
+        size_t typeflow_pops = 0;
+        size_t typeflow_pushes_deduplicated = 0;
+        size_t method_levels = 0;
+        size_t method_levels_bottom_up = 0;
+        size_t method_visits = 0;
+        uint64_t reached_cost = 0;
+
+        auto stopping = [&]
+        {
+            return (targets && targets->n_unreached == 0) || cancelled();
+        };
+
+        // Upper bound for the number of direct invokes that may still get explored top-down
+        size_t unexplored_edges = adj.n_direct_invokes();
+        bool bottom_up = false;
+
+        // A pending typeflow always propagates its latest history once it gets popped,
+        // therefore pushing it again before that would only repeat the same work.
+        auto push_typeflow = [&](typeflow_id v)
+        {
+            if(typeflow_pending[v.id])
+            {
+                typeflow_pushes_deduplicated++;
+                return;
+            }
+
+            typeflow_pending[v.id] = true;
+            typeflow_worklist.push(v);
+        };
 
         // Handle white-hole typeflow
         if(init_typeflows)
         {
             for(auto v: adj.flows[0].forward_edges)
             {
+                if(overlay && overlay->masked(typeflow_id(0), v))
+                    continue;
+
                 TypeSet filter = adj[v].filter;
                 bool changed = false;
-                TypeflowHistory before = typeflow_visited[v.id];
+                typename History::Snapshot before = track_changes ? typeflow_visited[v.id].snapshot() : typename History::Snapshot();
 
                 for(size_t t = filter.first(); t < adj.n_types(); t = filter.next(t))
                 {
-                    changed |= typeflow_visited[v.id].add_type(t, 0);
+                    bool added = typeflow_visited[v.id].add_type(t, 0);
+                    changed |= added;
+
+                    if constexpr(dist_matters)
+                        if(added)
+                            predecessors.typeflow_type(typeflow_visited[v.id], v, t, 0);
 
                     if(typeflow_visited[v.id].is_saturated())
                     {
@@ -267,10 +983,10 @@ public:
                 }
 
                 if(track_changes && changed)
-                    typeflow_visited_log.emplace_back(v, before);
+                    journal->push_typeflow(v, before);
 
                 if(changed && !adj[v].method.dependent())
-                    typeflow_worklist.push(v);
+                    push_typeflow(v);
             }
         }
 
@@ -281,54 +997,138 @@ public:
             do
             {
                 if(track_changes)
-                    std::copy(method_worklist.begin(), method_worklist.end(), back_inserter(visited_method_log));
+                    for(method_id u : method_worklist)
+                        journal->push(UndoJournal::Kind::visited_method, u.id);
+
+                {
+                    size_t frontier_edges = 0;
+                    for(method_id u: method_worklist)
+                        frontier_edges += adj[u].forward_edges.size();
+
+                    // Bottom-up pays off once the frontier has more outgoing edges than there are left to discover,
+                    // and stops paying off once the frontier got small again.
+                    if(!bottom_up)
+                        bottom_up = frontier_edges > unexplored_edges / bottom_up_alpha;
+                    else
+                        bottom_up = method_worklist.size() >= adj.n_methods() / bottom_up_beta;
+
+                    unexplored_edges -= min(unexplored_edges, frontier_edges);
+                    method_levels++;
+                    method_levels_bottom_up += bottom_up;
+                    method_visits += method_worklist.size();
+                }
 
                 for(method_id u: method_worklist)
                 {
-                    method_history[u.id] = DefaultMethodHistory(dist);
+                    methods.visit(u, dist);
+                    reached_cost += adj.method_costs[u.id];
+
+                    if(targets && targets->marks[u.id])
+                        targets->n_unreached--;
+
                     const auto& m = adj[u];
 
+                    for(type_t t : m.instantiated_types)
+                        if(type_instantiations[t]++ == 0)
+                            reached_cost += adj.type_costs[t];
+
                     for(auto v: m.dependent_typeflows)
+                    {
+                        // Nothing got propagated from here while the method was unreachable
+                        typeflow_visited[v.id].n_propagated = 0;
+
                         if(typeflow_visited[v.id].any())
-                            typeflow_worklist.push(v);
+                            push_typeflow(v);
+                    }
 
-                    for(auto v: m.forward_edges)
+                    if(bottom_up)
+                    {
+                        method_frontier[u.id] = true;
+                    }
+                    else
                     {
-                        if(!method_inhibited[v.id])
+                        bool calls_masked = overlay && overlay->masks_calls_from(u);
+
+                        for(auto v: m.forward_edges)
                         {
-                            method_inhibited[v.id] = true;
-                            next_method_worklist.push_back(v);
+                            if(calls_masked && overlay->masked(u, v))
+                                continue;
+
+                            if(methods.inhibit(v))
+                            {
+                                next_method_worklist.push_back(v);
+
+                                if constexpr(dist_matters)
+                                    predecessors.method(v, {PredecessorRecords::Method::Kind::call, 0, u.id});
+                            }
                         }
                     }
 
+                    // Hyperedges are always expanded top-down, because they depend on both sources having been visited at some point
                     for(auto he : m.forward_hyperedges)
                     {
+                        if(overlay && overlay->masked(he))
+                            continue;
+
                         bool other_src_visited = hyperedge_visited_atleast_once[he.id];
 
                         if(other_src_visited)
                         {
                             auto v = adj[he].dst;
-                            if(!method_inhibited[v.id])
+                            if(methods.inhibit(v))
                             {
-                                method_inhibited[v.id] = true;
                                 next_method_worklist.push_back(v);
+
+                                if constexpr(dist_matters)
+                                    predecessors.method(v, {PredecessorRecords::Method::Kind::hyperedge, 0, he.id});
                             }
                         }
                         else
                         {
-                            hyperedge_visited_atleast_once[he.id] = true;
+                            hyperedge_visited_atleast_once.set(he.id);
 
                             if(track_changes)
-                                visited_hyperedges_log.push_back(he);
+                                journal->push(UndoJournal::Kind::visited_hyperedge, he.id);
+                        }
+                    }
+                }
+
+                if(bottom_up)
+                {
+                    for(size_t v = 0; v < adj.n_methods(); v++)
+                    {
+                        if(methods.inhibited(v))
+                            continue;
+
+                        for(method_id u : adj.methods[v].backward_edges)
+                        {
+                            if(method_frontier[u.id] && !(overlay && overlay->masked(u, method_id(v))))
+                            {
+                                methods.inhibit(v);
+                                next_method_worklist.push_back(v);
+
+                                if constexpr(dist_matters)
+                                    predecessors.method(v, {PredecessorRecords::Method::Kind::call, 0, u.id});
+                                break;
+                            }
                         }
                     }
+
+                    for(method_id u: method_worklist)
+                        method_frontier[u.id] = false;
                 }
 
                 method_worklist.clear();
                 swap(method_worklist, next_method_worklist);
+
+                if(stopping())
+                    break;
             }
             while(!dist_matters && !method_worklist.empty());
 
+            if(stopping())
+                break;
+
             if(dist_matters)
                 dist++;
 
@@ -338,42 +1138,57 @@ public:
                 {
                     typeflow_id u = typeflow_worklist.front();
                     typeflow_worklist.pop();
+                    typeflow_pending[u.id] = false;
+                    typeflow_pops++;
 
                     method_id reaching = adj[u].method.reaching();
 
-                    if(!method_inhibited[reaching.id])
+                    if(methods.inhibit(reaching))
                     {
-                        method_inhibited[reaching.id] = true;
                         method_worklist.push_back(reaching);
+
+                        if constexpr(dist_matters)
+                            predecessors.method(reaching, {PredecessorRecords::Method::Kind::typeflow, typeflow_visited[u.id].types[0], u.id});
                     }
 
+                    bool interflows_masked = overlay && overlay->masks_interflows_from(u);
+
                     if(!typeflow_visited[u.id].is_saturated())
                     {
                         for(auto v: adj[u].forward_edges)
                         {
+                            if(interflows_masked && overlay->masked(u, v))
+                                continue;
+
                             if(!typeflow_visited[v.id].is_saturated())
                             {
                                 TypeSet filter = adj[v].filter;
 
                                 bool changed = false;
-                                TypeflowHistory before = typeflow_visited[v.id];
+                                typename History::Snapshot before = track_changes ? typeflow_visited[v.id].snapshot() : typename History::Snapshot();
 
-                                for(pair<type_t, uint8_t> type: typeflow_visited[u.id])
+                                // The older types already reached v when u got processed before
+                                for(pair<type_t, uint8_t> type: typeflow_visited[u.id].unpropagated())
                                 {
                                     if(!filter[type.first])
                                         continue;
 
-                                    changed |= typeflow_visited[v.id].add_type(type.first, dist);
+                                    bool added = typeflow_visited[v.id].add_type(type.first, dist);
+                                    changed |= added;
+
+                                    if constexpr(dist_matters)
+                                        if(added)
+                                            predecessors.typeflow_type(typeflow_visited[v.id], v, type.first, u);
 
                                     if(typeflow_visited[v.id].is_saturated())
                                         break;
                                 }
 
                                 if(track_changes && changed)
-                                    typeflow_visited_log.emplace_back(v, before);
+                                    journal->push_typeflow(v, before);
 
-                                if(changed && method_history[adj[v].method.dependent().id])
-                                    typeflow_worklist.push(v);
+                                if(changed && methods.visited(adj[v].method.dependent()))
+                                    push_typeflow(v);
                             }
 
                             if(typeflow_visited[v.id].is_saturated())
@@ -383,11 +1198,17 @@ public:
                                     if(!allInstantiated[type.first] && adj[v].filter[type.first])
                                     {
                                         allInstantiated[type.first] = true;
+
+                                        if constexpr(dist_matters)
+                                            predecessors.instantiation(type.first, u);
+
                                         instantiated_since_last_iteration.push_back(type.first);
                                     }
                                 }
                             }
                         }
+
+                        typeflow_visited[u.id].mark_propagated();
                     }
                     else
                     {
@@ -396,12 +1217,19 @@ public:
                             if(!allInstantiated[type.first])
                             {
                                 allInstantiated[type.first] = true;
+
+                                if constexpr(dist_matters)
+                                    predecessors.instantiation(type.first, u);
+
                                 instantiated_since_last_iteration.push_back(type.first);
                             }
                         }
 
                         for(auto v: adj[u].forward_edges)
                         {
+                            if(interflows_masked && overlay->masked(u, v))
+                                continue;
+
                             if(typeflow_visited[v.id].is_saturated())
                                 continue;
 
@@ -409,11 +1237,13 @@ public:
                                 continue;
 
                             included_in_saturation_uses[v.id] = true;
+                            if constexpr(dist_matters)
+                                predecessors.saturation_use(v, u);
                             if(track_changes)
-                                included_in_saturation_uses_log.push_back(v);
+                                journal->push(UndoJournal::Kind::included_in_saturation_uses, v.id);
 
                             bool changed = false;
-                            TypeflowHistory before = typeflow_visited[v.id];
+                            typename History::Snapshot before = track_changes ? typeflow_visited[v.id].snapshot() : typename History::Snapshot();
 
                             TypeSet filter = adj[v].filter;
 
@@ -422,7 +1252,12 @@ public:
                                 if(!allInstantiated[t])
                                     continue;
 
-                                changed |= typeflow_visited[v.id].add_type(t, dist);
+                                bool added = typeflow_visited[v.id].add_type(t, dist);
+                                changed |= added;
+
+                                if constexpr(dist_matters)
+                                    if(added)
+                                        predecessors.typeflow_type(typeflow_visited[v.id], v, t, PredecessorRecords::from_all_instantiated);
 
                                 if(typeflow_visited[v.id].is_saturated())
                                     break;
@@ -430,16 +1265,18 @@ public:
 
                             if(!typeflow_visited[v.id].is_saturated())
                             {
-                                saturation_uses_by_filter[adj[v].original_filter - adj.filters_begin].push_back(v);
+                                uint32_t filter_id = adj[v].original_filter - adj.filters_begin;
+                                saturation_uses_by_filter[filter_id].push_back(v);
+                                active_filters.insert(filter_id);
                                 if(track_changes)
-                                    saturation_uses_by_filter_added_log.push_back(v);
+                                    journal->push(UndoJournal::Kind::saturation_use_added, v.id);
                             }
 
                             if(track_changes && changed)
-                                typeflow_visited_log.emplace_back(v, before);
+                                journal->push_typeflow(v, before);
 
-                            if(changed && method_history[adj[v].method.dependent().id])
-                                typeflow_worklist.push(v);
+                            if(changed && methods.visited(adj[v].method.dependent()))
+                                push_typeflow(v);
                         }
                     }
                 }
@@ -453,24 +1290,48 @@ public:
 
                 vector<type_t> instantiated_since_last_iteration_filtered;
 
-                for(size_t filter_id = 0; filter_id < adj.filter_filters.size(); filter_id++)
+                // Only active filters that admit a newly instantiated type can spread anything.
+                // Depending on which is smaller, they are either looked up by type or taken from the active set.
                 {
-                    auto& saturation_uses = saturation_uses_by_filter[filter_id];
+                    size_t n_filters_by_type = 0;
+                    for(type_t type : instantiated_since_last_iteration)
+                        n_filters_by_type += adj.filters_by_type[type].size();
 
-                    if(saturation_uses.empty())
-                        continue;
+                    if(n_filters_by_type < active_filters.size())
+                    {
+                        for(type_t type : instantiated_since_last_iteration)
+                            for(uint32_t filter_id : adj.filters_by_type[type])
+                                if(active_filters.contains(filter_id))
+                                    filters_to_spread.push_back(filter_id);
+                    }
+                    else
+                    {
+                        filters_to_spread.assign(active_filters.begin(), active_filters.end());
+                    }
+
+                    // Keeps the order of spreading independent of the order of activation
+                    std::sort(filters_to_spread.begin(), filters_to_spread.end());
+                    filters_to_spread.erase(std::unique(filters_to_spread.begin(), filters_to_spread.end()), filters_to_spread.end());
+                }
+
+                for(uint32_t filter_id : filters_to_spread)
+                {
+                    auto& saturation_uses = saturation_uses_by_filter[filter_id];
 
                     if(track_changes)
                     {
                         for(typeflow_id v : saturation_uses)
                             if(typeflow_visited[v.id].is_saturated())
-                                saturation_uses_by_filter_removed_log.push_back(v);
+                                journal->push(UndoJournal::Kind::saturation_use_removed, v.id);
                     }
 
                     erase_if(saturation_uses, [&typeflow_visited](typeflow_id v){ return typeflow_visited[v.id].is_saturated(); });
 
                     if(saturation_uses.empty())
+                    {
+                        active_filters.erase(filter_id);
                         continue;
+                    }
 
                     TypeSet filter = adj.filter_filters[filter_id];
 
@@ -515,93 +1376,179 @@ public:
                         else
                         {
                             bool changed = false;
-                            TypeflowHistory before = typeflow_visited[v.id];
+                            typename History::Snapshot before = track_changes ? typeflow_visited[v.id].snapshot() : typename History::Snapshot();
 
                             for(type_t type : instantiated_since_last_iteration_filtered)
                             {
-                                changed |= typeflow_visited[v.id].add_type(type, dist);
+                                bool added = typeflow_visited[v.id].add_type(type, dist);
+                                changed |= added;
+
+                                if constexpr(dist_matters)
+                                    if(added)
+                                        predecessors.typeflow_type(typeflow_visited[v.id], v, type, PredecessorRecords::from_all_instantiated);
 
                                 if(typeflow_visited[v.id].is_saturated())
                                     break;
                             }
 
                             if(track_changes && changed)
-                                typeflow_visited_log.emplace_back(v, before);
+                                journal->push_typeflow(v, before);
 
-                            if(changed && method_history[adj[v].method.dependent().id])
-                                typeflow_worklist.push(v);
+                            if(changed && methods.visited(adj[v].method.dependent()))
+                                push_typeflow(v);
 
                             it++;
                         }
                     }
 
+                    if(saturation_uses.empty())
+                        active_filters.erase(filter_id);
+
                     instantiated_since_last_iteration_filtered.clear();
                 }
 
+                filters_to_spread.clear();
 
                 if(track_changes)
-                    std::copy(instantiated_since_last_iteration.begin(), instantiated_since_last_iteration.end(), back_inserter(allInstantiated_log));
+                    for(type_t type : instantiated_since_last_iteration)
+                        journal->push(UndoJournal::Kind::instantiated_type, type);
 
                 instantiated_since_last_iteration.clear();
             }
         }
 
+        if(stopping())
+        {
+            // Keep the state consistent with the journal and the invariants between runs
+            if(track_changes)
+            {
+                for(method_id u : method_worklist)
+                    journal->push(UndoJournal::Kind::visited_method, u.id);
+                for(type_t type : instantiated_since_last_iteration)
+                    journal->push(UndoJournal::Kind::instantiated_type, type);
+            }
+
+            instantiated_since_last_iteration.clear();
+
+            while(!typeflow_worklist.empty())
+            {
+                typeflow_pending[typeflow_worklist.front().id] = false;
+                typeflow_worklist.pop();
+            }
+        }
+
         assert(instantiated_since_last_iteration.empty());
 
-        this->method_inhibited = std::move(method_inhibited);
+        this->methods = std::move(methods);
         this->hyperedge_visited_atleast_once = std::move(hyperedge_visited_atleast_once);
-        this->method_history = std::move(method_history);
         this->typeflow_visited = std::move(typeflow_visited);
         this->allInstantiated = std::move(allInstantiated);
         this->included_in_saturation_uses = std::move(included_in_saturation_uses);
         this->saturation_uses_by_filter = std::move(saturation_uses_by_filter);
-
-        return ResultDiff(std::move(visited_method_log), std::move(visited_hyperedges_log), std::move(typeflow_visited_log), std::move(allInstantiated_log), std::move(included_in_saturation_uses_log), std::move(saturation_uses_by_filter_added_log), std::move(saturation_uses_by_filter_removed_log));
+        this->active_filters = std::move(active_filters);
+        this->typeflow_pending = std::move(typeflow_pending);
+        this->method_frontier = std::move(method_frontier);
+
+        stats.typeflow_pops += typeflow_pops;
+        stats.typeflow_pushes_deduplicated += typeflow_pushes_deduplicated;
+        stats.method_levels += method_levels;
+        stats.method_levels_bottom_up += method_levels_bottom_up;
+        stats.method_visits += method_visits;
+        this->reached_cost += reached_cost;
     }
 
-    void revert(const Adjacency& adj, const ResultDiff& changes)
+    [[nodiscard]] bool cancelled() const
     {
-        for(method_id m : changes.visited_method_log)
-        {
-            method_inhibited[m.id] = false;
-            method_history[m.id] = {};
-        }
+        return cancel && cancel->load(memory_order_relaxed);
+    }
 
-        for(hyperedge_id he : changes.visited_hyperedge_log)
-        {
-            assert(hyperedge_visited_atleast_once[he.id]);
-            hyperedge_visited_atleast_once[he.id] = false;
-        }
+    // Whether the method gets reached from the current state once it isn't inhibited anymore
+    [[nodiscard]] bool has_reached_predecessor(const Adjacency& adj, method_id mid) const
+    {
+        const auto& m = adj[mid];
+
+        return std::any_of(m.backward_edges.begin(), m.backward_edges.end(), [&](const auto& item)
+               {
+                   return methods.visited(item) && !(overlay && overlay->masked(item, mid));
+               })
+               ||
+               std::any_of(m.backward_hyperedges.begin(), m.backward_hyperedges.end(), [&](const auto& item)
+               {
+                   const auto& he = adj[item];
+                   return methods.visited(he.src1) && methods.visited(he.src2) && !(overlay && overlay->masked(item));
+               })
+               ||
+               std::any_of(m.virtual_invocation_sources.begin(), m.virtual_invocation_sources.end(), [&](const auto& item)
+               {
+                   return typeflow_visited[item.id].any();
+               });
+    }
 
-        for(size_t i = changes.typeflow_visited_log.size(); i > 0; i--)
+    // Undoes the changes recorded into the journal since the given offset
+    void revert(const Adjacency& adj, UndoJournal& journal, size_t offset)
+    {
+        journal.unwind(offset, [&](UndoJournal::Kind kind, uint32_t id, uint32_t snapshot_word)
         {
-            const auto& change = changes.typeflow_visited_log[i-1];
-            typeflow_visited[change.first.id] = change.second;
-        }
+            switch(kind)
+            {
+                case UndoJournal::Kind::visited_method:
+                    // After an early stop, the last level only got inhibited
+                    if(methods.visited(id))
+                    {
+                        reached_cost -= adj.method_costs[id];
 
-        for(auto t : changes.allInstantiated_log)
-        {
-            allInstantiated[t] = false;
-        }
+                        for(type_t t : adj.methods[id].instantiated_types)
+                            if(--type_instantiations[t] == 0)
+                                reached_cost -= adj.type_costs[t];
+                    }
+                    methods.reset(id);
+                    break;
+                case UndoJournal::Kind::visited_hyperedge:
+                    assert(hyperedge_visited_atleast_once[id]);
+                    hyperedge_visited_atleast_once.reset(id);
+                    break;
+                case UndoJournal::Kind::typeflow:
+                    typeflow_visited[id].restore({(uint8_t)snapshot_word, (uint8_t)(snapshot_word >> 8), (uint8_t)(snapshot_word >> 16)});
+                    break;
+                case UndoJournal::Kind::instantiated_type:
+                    allInstantiated[id] = false;
+                    break;
+                case UndoJournal::Kind::included_in_saturation_uses:
+                    included_in_saturation_uses[id] = false;
+                    break;
+                case UndoJournal::Kind::saturation_use_added:
+                    reverted_additions.push_back(id);
+                    break;
+                case UndoJournal::Kind::saturation_use_removed:
+                    reverted_saturation_uses.push_back(id);
+                    break;
+            }
+        });
 
-        for(typeflow_id flow : changes.included_in_saturation_uses_log)
+        // Restore removed saturation uses in their original order
+        for(size_t i = reverted_saturation_uses.size(); i > 0; i--)
         {
-            included_in_saturation_uses[flow.id] = false;
+            typeflow_id flow = reverted_saturation_uses[i-1];
+            uint32_t filter_id = adj[flow].original_filter - adj.filters_begin;
+            saturation_uses_by_filter[filter_id].push_back(flow);
+            active_filters.insert(filter_id);
         }
 
-        for(typeflow_id flow : changes.saturation_uses_by_filter_removed_log)
+        for(typeflow_id flow : reverted_additions)
         {
-            saturation_uses_by_filter[adj[flow].original_filter - adj.filters_begin].push_back(flow);
+            uint32_t filter_id = adj[flow].original_filter - adj.filters_begin;
+            erase(saturation_uses_by_filter[filter_id], flow);
+            if(saturation_uses_by_filter[filter_id].empty())
+                active_filters.erase(filter_id);
         }
 
-        for(typeflow_id flow : changes.saturation_uses_by_filter_added_log)
-        {
-            erase(saturation_uses_by_filter[adj[flow].original_filter - adj.filters_begin], flow);
-        }
+        reverted_saturation_uses.clear();
+        reverted_additions.clear();
     }
 };
 
-static void assert_reachability_equals(const BFS& r1, const BFS& r2)
+template<bool dist_matters1, bool dist_matters2>
+static void assert_reachability_equals(const BFS<dist_matters1>& r1, const BFS<dist_matters2>& r2)
 {
     if(!(r1.allInstantiated == r2.allInstantiated))
     {
@@ -616,7 +1563,7 @@ static void assert_reachability_equals(const BFS& r1, const BFS& r2)
         }
     }
 
-    if(r1.method_history.size() != r2.method_history.size())
+    if(r1.methods.size() != r2.methods.size())
     {
         cerr << "Sizable Idiot!" << endl;
         exit(1);
@@ -672,11 +1619,11 @@ static void assert_reachability_equals(const BFS& r1, const BFS& r2)
         }
     }
 
-    for(size_t i = 0; i < r1.method_history.size(); i++)
+    for(size_t i = 0; i < r1.methods.size(); i++)
     {
-        if(bool(r1.method_history[i]) != bool(r2.method_history[i]))
+        if(r1.methods.visited(i) != r2.methods.visited(i))
         {
-            cerr << "Method history differs (mid: " << i << "): " << (uint32_t)r1.method_history[i].dist << " != " << (uint32_t)r2.method_history[i].dist << endl;
+            cerr << "Method history differs (mid: " << i << "): " << (uint32_t)r1.methods.dist(i) << " != " << (uint32_t)r2.methods.dist(i) << endl;
             exit(1);
         }
     }
@@ -695,25 +1642,26 @@ class IncrementalBfs
         span<const PurgeTreeNode> stillpurge;
         size_t mid_index = 0;
         span<const PurgeTreeNode> depurge;
-        BFS::ResultDiff incremental_changes;
+        // Offset into the journal where the changes of this frame begin
+        size_t journal_offset = 0;
 
-        BfsIncrementalFrame(span<const PurgeTreeNode> stillpurge, span<const PurgeTreeNode> depurge, BFS::ResultDiff&& incremental_changes)
-                : stillpurge(stillpurge), depurge(depurge), incremental_changes(std::move(incremental_changes))
+        BfsIncrementalFrame(span<const PurgeTreeNode> stillpurge, span<const PurgeTreeNode> depurge, size_t journal_offset)
+                : stillpurge(stillpurge), depurge(depurge), journal_offset(journal_offset)
         { }
 
-        BfsIncrementalFrame(span<const PurgeTreeNode> stillpurge)
-                : stillpurge(stillpurge)
+        BfsIncrementalFrame(span<const PurgeTreeNode> stillpurge, size_t journal_offset)
+                : stillpurge(stillpurge), journal_offset(journal_offset)
         { }
     };
 
     const Adjacency& adj;
-    BFS r;
+    BFS<false> r;
     // Replaced the former callstack-resident implicit state
     stack<BfsIncrementalFrame> state;
-
+    // Changes of all frames on the stack, oldest first
+    UndoJournal journal;
     void do_purge(span<const PurgeTreeNode> stillpurge, span<const PurgeTreeNode> depurge)
     {
-        auto& method_visited = r.method_inhibited;
         size_t root_methods_capacity = std::accumulate(depurge.begin(), depurge.end(), size_t(0), [](size_t acc, const auto& node){ return acc + node.mids.size(); });
         vector<method_id> root_methods;
         root_methods.reserve(root_methods_capacity);
@@ -722,53 +1670,43 @@ class IncrementalBfs
         {
             for(method_id mid : node.mids)
             {
-                method_visited[mid.id] = false;
+                r.methods.uninhibit(mid);
 
-                const auto& m = adj[mid];
-                if(
-                        std::any_of(m.backward_edges.begin(), m.backward_edges.end(), [&](const auto& item)
-                        {
-                            return (bool)r.method_history[item.id];
-                        })
-                        ||
-                        std::any_of(m.backward_hyperedges.begin(), m.backward_hyperedges.end(), [&](const auto& item)
-                        {
-                            const auto& he = adj[item];
-                            return (bool)r.method_history[he.src1.id] && (bool)r.method_history[he.src2.id];
-                        })
-                        ||
-                        std::any_of(m.virtual_invocation_sources.begin(), m.virtual_invocation_sources.end(), [&](const auto& item)
-                        {
-                            return r.typeflow_visited[item.id].any();
-                        })
-                        )
-                {
+                if(r.has_reached_predecessor(adj, mid))
                     root_methods.push_back(mid);
-                }
             }
         }
 
-        auto incremental_changes = r.run<false, true>(adj, root_methods, false);
-        state.emplace(stillpurge, depurge, std::move(incremental_changes));
+        size_t journal_offset = journal.size();
+        r.run<true>(adj, root_methods, false, &journal);
+        state.emplace(stillpurge, depurge, journal_offset);
     };
 
 public:
-    IncrementalBfs(const Adjacency& adj, span<const PurgeTreeNode> purges) : adj(adj), r(adj)
+    // Once the cancel token is set, next() returns nullptr and the current result is incomplete
+    IncrementalBfs(const Adjacency& adj, span<const PurgeTreeNode> purges, const EdgeOverlay* overlay = nullptr, const atomic<bool>* cancel = nullptr) : adj(adj), r(adj)
     {
+        r.overlay = overlay;
+        r.cancel = cancel;
+
         for(const PurgeTreeNode& node : purges)
             for(method_id mid : node.mids)
-                r.method_inhibited[mid.id] = true;
+                r.methods.inhibit(mid);
 
         method_id root_method = 0;
-        r.run<false>(adj, {&root_method, 1}, true);
+        r.run(adj, {&root_method, 1}, true);
 
-        state.emplace(purges);
+        state.emplace(purges, journal.size());
     }
 
     const PurgeTreeNode* next()
     {
         while(!state.empty())
         {
+            // A partial run can't be told apart from a complete one, so nothing gets returned after cancellation
+            if(r.cancelled())
+                return nullptr;
+
             BfsIncrementalFrame& s = state.top();
 
             if(s.mid_index == 0)
@@ -778,8 +1716,9 @@ public:
                     s.mid_index = 1;
                     const PurgeTreeNode& node = s.stillpurge.front();
 
+                    // The children only revert their own changes, not those of the enclosing frames
                     if(!s.stillpurge.front().children.empty())
-                        state.emplace(s.stillpurge.front().children);
+                        state.emplace(s.stillpurge.front().children, journal.size());
 
                     return &node;
                 }
@@ -788,7 +1727,7 @@ public:
                     // Divide the purge sets into two of similar sum-size for algorithmic performance reasons
                     size_t n_total_methods = 0;
 
-                    for(const auto node : s.stillpurge)
+                    for(const auto& node : s.stillpurge)
                         n_total_methods += node.mids.size();
 
                     for(size_t mid_size = 0; s.mid_index < s.stillpurge.size() && mid_size < n_total_methods / 2; s.mid_index++)
@@ -802,6 +1741,9 @@ public:
                         }
                     }
 
+                    // Both halves must be non-empty, even if a single purge set holds most of the methods
+                    s.mid_index = std::clamp(s.mid_index, size_t(1), s.stillpurge.size() - 1);
+
                     do_purge(s.stillpurge.subspan(0, s.mid_index), s.stillpurge.subspan(s.mid_index));
                 }
             }
@@ -813,27 +1755,345 @@ public:
             }
             else
             {
-                r.revert(adj, s.incremental_changes);
+                r.revert(adj, journal, s.journal_offset);
                 for(const PurgeTreeNode& node : s.depurge)
                     for(method_id mid : node.mids)
-                        r.method_inhibited[mid.id] = true;
+                        r.methods.inhibit(mid);
                 state.pop();
             }
         }
         return nullptr;
     }
 
-    [[nodiscard]] const BFS& current_result() const
+    [[nodiscard]] const BFS<false>& current_result() const
+    {
+        return r;
+    }
+};
+
+/* Keeps the state of a BFS allocated across queries.
+ * A query touches most of the state anyway, so resetting it densely in place is cheaper
+ * than tracking the touched slots during the traversal. */
+template<bool dist_matters>
+class BfsWorkspace
+{
+    const Adjacency& adj;
+    BFS<dist_matters> r;
+
+public:
+    explicit BfsWorkspace(const Adjacency& adj, const EdgeOverlay* overlay = nullptr) : adj(adj), r(adj)
+    {
+        r.overlay = overlay;
+    }
+
+    // The result stays valid until the next call of run() or reset()
+    const BFS<dist_matters>& run(span<const method_id> purged_methods = {})
+    {
+        reset();
+
+        for(method_id purged : purged_methods)
+            r.methods.inhibit(purged);
+
+        method_id root_method = 0;
+        r.run(adj, {&root_method, 1}, true);
+
+        for(method_id purged : purged_methods)
+            r.methods.uninhibit(purged);
+
+        return r;
+    }
+
+    void reset()
+    {
+        r.clear();
+    }
+};
+
+/* Fixpoints of the most recently simulated purge sets, since interactive use keeps coming back to a few of them.
+ * A purge set that isn't cached starts from the fixpoint of its smallest cached superset, if any,
+ * and only depurges the methods that the superset purges additionally, like IncrementalBfs does.
+ * Starting from a subset instead would need to take back reachability, which the BFS can't do. */
+class PurgeResultCache
+{
+public:
+    struct Stats
+    {
+        uint32_t hits = 0;
+        // Misses that started from the fixpoint of a cached superset
+        uint32_t superset_hits = 0;
+        uint32_t misses = 0;
+    };
+
+private:
+    struct Entry
+    {
+        uint64_t hash;
+        // Sorted and without duplicates
+        vector<method_id> purge_set;
+        BFS<false> r;
+        uint64_t last_use;
+        // r.used_memory_size() as of the last run
+        size_t memory_size = 0;
+    };
+
+    const Adjacency& adj;
+    size_t memory_budget;
+    // Sum of the memory sizes of the entries
+    size_t memory_used = 0;
+    // Largest memory size of an entry so far, which a new one is expected to need as well
+    size_t max_entry_size = 0;
+    vector<unique_ptr<Entry>> entries;
+    uint64_t n_uses = 0;
+    Stats _stats;
+    // Scratch space of run()
+    vector<method_id> root_methods;
+
+    static bool id_less(method_id a, method_id b)
+    {
+        return a.id < b.id;
+    }
+
+    // FNV-1a over the sorted ids
+    static uint64_t hash(span<const method_id> purge_set)
+    {
+        uint64_t h = 0xcbf29ce484222325;
+        for(method_id m : purge_set)
+        {
+            for(size_t shift = 0; shift < 32; shift += 8)
+            {
+                h ^= (m.id >> shift) & 0xFF;
+                h *= 0x100000001b3;
+            }
+        }
+        return h;
+    }
+
+    auto least_recently_used(const Entry* except = nullptr)
+    {
+        return std::min_element(entries.begin(), entries.end(), [&](const auto& a, const auto& b)
+        { return a.get() != except && (b.get() == except || a->last_use < b->last_use); });
+    }
+
+    // Slot for a new entry, which is the least recently used one if another entry wouldn't fit into the budget
+    Entry& slot()
+    {
+        if(entries.empty() || memory_used + max_entry_size <= memory_budget)
+            return *entries.emplace_back(new Entry{0, {}, BFS<false>(adj), 0});
+
+        return **least_recently_used();
+    }
+
+    // Evicts the least recently used entries other than the given one until the budget is kept
+    void shrink_to_budget(const Entry& keep)
+    {
+        while(memory_used > memory_budget && entries.size() > 1)
+        {
+            auto victim = least_recently_used(&keep);
+            memory_used -= (*victim)->memory_size;
+            *victim = std::move(entries.back());
+            entries.pop_back();
+        }
+    }
+
+public:
+    // Keeps at least one fixpoint, even if that alone exceeds the budget
+    PurgeResultCache(const Adjacency& adj, size_t memory_budget) : adj(adj), memory_budget(memory_budget) {}
+
+    // The result stays valid until the next call of run()
+    const BFS<false>& run(span<const method_id> purged_methods)
     {
+        vector<method_id> purge_set(purged_methods.begin(), purged_methods.end());
+        std::sort(purge_set.begin(), purge_set.end(), id_less);
+        purge_set.erase(std::unique(purge_set.begin(), purge_set.end()), purge_set.end());
+        uint64_t h = hash(purge_set);
+
+        Entry* superset = nullptr;
+
+        for(const auto& e : entries)
+        {
+            if(e->hash == h && e->purge_set == purge_set)
+            {
+                _stats.hits++;
+                e->last_use = ++n_uses;
+                return e->r;
+            }
+
+            if(e->purge_set.size() > purge_set.size()
+               && (!superset || e->purge_set.size() < superset->purge_set.size())
+               && std::includes(e->purge_set.begin(), e->purge_set.end(), purge_set.begin(), purge_set.end(), id_less))
+                superset = e.get();
+        }
+
+        // The superset itself may get evicted, which then gets depurged in place
+        Entry& entry = slot();
+        BFS<false>& r = entry.r;
+
+        if(superset)
+        {
+            _stats.superset_hits++;
+            if(&entry != superset)
+                r = superset->r;
+
+            for(method_id purged : purge_set)
+                r.methods.inhibit(purged);
+
+            root_methods.clear();
+            std::set_difference(superset->purge_set.begin(), superset->purge_set.end(), purge_set.begin(), purge_set.end(), std::back_inserter(root_methods), id_less);
+            erase_if(root_methods, [&](method_id m) { return !r.has_reached_predecessor(adj, m); });
+
+            r.run(adj, root_methods, false);
+        }
+        else
+        {
+            _stats.misses++;
+            r.clear();
+
+            for(method_id purged : purge_set)
+                r.methods.inhibit(purged);
+
+            method_id root_method = 0;
+            r.run(adj, {&root_method, 1}, true);
+        }
+
+        for(method_id purged : purge_set)
+            r.methods.uninhibit(purged);
+
+        entry.hash = h;
+        entry.purge_set = std::move(purge_set);
+        entry.last_use = ++n_uses;
+
+        memory_used -= entry.memory_size;
+        entry.memory_size = r.used_memory_size() + entry.purge_set.capacity() * sizeof(method_id);
+        memory_used += entry.memory_size;
+        max_entry_size = max(max_entry_size, entry.memory_size);
+        shrink_to_budget(entry);
         return r;
     }
+
+    [[nodiscard]] const Stats& stats() const
+    {
+        return _stats;
+    }
+};
+
+// Methods and typeflows that may contribute to reaching any of the targets
+struct BackwardCone
+{
+    vector<bool> methods;
+    vector<typeflow_id> typeflows;
+
+    BackwardCone(const Adjacency& adj, span<const method_id> targets) : methods(adj.n_methods())
+    {
+        vector<bool> typeflow_included(adj.n_typeflows());
+        vector<method_id> method_worklist;
+
+        auto include_method = [&](method_id m)
+        {
+            if(!methods[m.id])
+            {
+                methods[m.id] = true;
+                method_worklist.push_back(m);
+            }
+        };
+
+        auto include_typeflow = [&](typeflow_id v)
+        {
+            if(!typeflow_included[v.id])
+            {
+                typeflow_included[v.id] = true;
+                typeflows.push_back(v);
+            }
+        };
+
+        include_method(0);
+        for(method_id m : targets)
+            include_method(m);
+
+        size_t typeflows_processed = 0;
+
+        while(!method_worklist.empty() || typeflows_processed < typeflows.size())
+        {
+            while(!method_worklist.empty())
+            {
+                method_id m = method_worklist.back();
+                method_worklist.pop_back();
+
+                for(method_id prev : adj[m].backward_edges)
+                    include_method(prev);
+
+                for(hyperedge_id he : adj[m].backward_hyperedges)
+                {
+                    include_method(adj[he].src1);
+                    include_method(adj[he].src2);
+                }
+
+                for(typeflow_id v : adj[m].virtual_invocation_sources)
+                    include_typeflow(v);
+            }
+
+            while(typeflows_processed < typeflows.size())
+            {
+                typeflow_id v = typeflows[typeflows_processed++];
+
+                // A typeflow only propagates once its method got reached
+                include_method(adj[v].method.dependent());
+
+                for(typeflow_id prev : adj[v].backward_edges)
+                    include_typeflow(prev);
+            }
+        }
+    }
 };
 
-static void bfs_incremental(const Adjacency& adj, span<const PurgeTreeNode> methods_to_purge, const function<void(const PurgeTreeNode&, const BFS&)>& callback)
+/* Decides which of the targets stay reachable after purging the given methods, without necessarily computing the whole fixpoint:
+ * Methods outside the backward cone of the targets stay inhibited, and the BFS stops as soon as all targets are reached.
+ * Only saturation can carry types into the cone from outside. Thus, if a typeflow of the cone got saturated and some targets are still missing,
+ * the remaining methods get depurged and the BFS continues incrementally. */
+static vector<bool> simulate_purge_targeted(const Adjacency& adj, span<const method_id> purged_methods, span<const method_id> targets)
+{
+    BackwardCone cone(adj, targets);
+    BFS<false> r(adj);
+    BFS<false>::Targets remaining(adj.n_methods(), targets);
+
+    for(method_id purged : purged_methods)
+        r.methods.inhibit(purged);
+
+    vector<method_id> outside_cone;
+
+    for(size_t i = 1; i < adj.n_methods(); i++)
+        if(!cone.methods[i] && r.methods.inhibit(i))
+            outside_cone.push_back(i);
+
+    method_id root_method = 0;
+    r.run(adj, {&root_method, 1}, true, nullptr, &remaining);
+
+    if(remaining.n_unreached != 0 && std::any_of(cone.typeflows.begin(), cone.typeflows.end(), [&](typeflow_id v) { return r.typeflow_visited[v.id].is_saturated(); }))
+    {
+        vector<method_id> root_methods;
+
+        for(method_id mid : outside_cone)
+            r.methods.uninhibit(mid);
+
+        for(method_id mid : outside_cone)
+            if(r.has_reached_predecessor(adj, mid))
+                root_methods.push_back(mid);
+
+        r.run(adj, root_methods, false, nullptr, &remaining);
+    }
+
+    vector<bool> reachable(targets.size());
+    for(size_t i = 0; i < targets.size(); i++)
+        reachable[i] = r.methods.visited(targets[i]);
+    return reachable;
+}
+
+// Returns the stats accumulated over all simulations
+static BFS<false>::Stats bfs_incremental(const Adjacency& adj, span<const PurgeTreeNode> methods_to_purge, const function<void(const PurgeTreeNode&, const BFS<false>&)>& callback, const EdgeOverlay* overlay = nullptr)
 {
-    IncrementalBfs ibfs(adj, methods_to_purge);
+    IncrementalBfs ibfs(adj, methods_to_purge, overlay);
     while(auto n = ibfs.next())
         callback(*n, ibfs.current_result());
+    return ibfs.current_result().stats;
 }
 
 #endif //CAUSALITY_GRAPH_ANALYSIS_H
@@ -0,0 +1,492 @@
+#ifndef CAUSALITY_GRAPH_DOMINATORS_H
+#define CAUSALITY_GRAPH_DOMINATORS_H
+
+#include <vector>
+#include <span>
+#include "model.h"
+#include "analysis.h"
+#include "parallel.h"
+
+using namespace std;
+
+/* Dominator tree of a graph given in CSR form, computed with the algorithm of Lengauer and Tarjan
+ * (simple variant with path compression). Nodes that can't be reached from the root have no immediate dominator. */
+class DominatorTree
+{
+public:
+    static constexpr uint32_t none = numeric_limits<uint32_t>::max();
+
+private:
+    vector<uint32_t> _idom;
+    vector<uint32_t> _depth;
+    // Position in a preorder of the dominator tree, such that every subtree occupies a contiguous range
+    vector<uint32_t> _preorder;
+    vector<uint32_t> _subtree_size;
+    // Reachable nodes in DFS order, in which every node comes after its immediate dominator
+    vector<uint32_t> _order;
+
+public:
+    DominatorTree(uint32_t root, span<const uint32_t> succ_offsets, span<const uint32_t> succ)
+    {
+        size_t n_nodes = succ_offsets.size() - 1;
+
+        vector<uint32_t> pred_offsets(n_nodes + 1);
+        vector<uint32_t> pred(succ.size());
+
+        for(uint32_t w : succ)
+            pred_offsets[w + 1]++;
+        for(size_t i = 0; i < n_nodes; i++)
+            pred_offsets[i + 1] += pred_offsets[i];
+        {
+            vector<uint32_t> fill_pos(pred_offsets.begin(), pred_offsets.end() - 1);
+            for(size_t v = 0; v < n_nodes; v++)
+                for(size_t i = succ_offsets[v]; i < succ_offsets[v + 1]; i++)
+                    pred[fill_pos[succ[i]]++] = v;
+        }
+
+        // DFS numbering. From here on, all arrays except dfnum are indexed by DFS number.
+        vector<uint32_t> dfnum(n_nodes, none);
+        vector<uint32_t> parent;
+        {
+            vector<pair<uint32_t, uint32_t>> stack;
+
+            dfnum[root] = 0;
+            _order.push_back(root);
+            parent.push_back(0);
+            stack.emplace_back(root, succ_offsets[root]);
+
+            while(!stack.empty())
+            {
+                auto& [v, next] = stack.back();
+
+                if(next == succ_offsets[v + 1])
+                {
+                    stack.pop_back();
+                    continue;
+                }
+
+                uint32_t w = succ[next++];
+
+                if(dfnum[w] == none)
+                {
+                    dfnum[w] = _order.size();
+                    _order.push_back(w);
+                    parent.push_back(dfnum[v]);
+                    stack.emplace_back(w, succ_offsets[w]);
+                }
+            }
+        }
+
+        size_t n_reachable = _order.size();
+        vector<uint32_t> semi(n_reachable);
+        vector<uint32_t> idom(n_reachable);
+        vector<uint32_t> ancestor(n_reachable, none);
+        vector<uint32_t> label(n_reachable);
+        vector<uint32_t> bucket_head(n_reachable, none);
+        vector<uint32_t> bucket_next(n_reachable, none);
+        vector<uint32_t> compress_path;
+
+        std::iota(semi.begin(), semi.end(), 0);
+        std::iota(label.begin(), label.end(), 0);
+
+        auto eval = [&](uint32_t v)
+        {
+            if(ancestor[v] == none)
+                return v;
+
+            // Iterative form of the recursive path compression
+            for(uint32_t x = v; ancestor[ancestor[x]] != none; x = ancestor[x])
+                compress_path.push_back(x);
+
+            while(!compress_path.empty())
+            {
+                uint32_t x = compress_path.back();
+                compress_path.pop_back();
+                uint32_t a = ancestor[x];
+
+                if(semi[label[a]] < semi[label[x]])
+                    label[x] = label[a];
+                ancestor[x] = ancestor[a];
+            }
+
+            return label[v];
+        };
+
+        for(uint32_t w = n_reachable - 1; w > 0; w--)
+        {
+            uint32_t node = _order[w];
+
+            for(size_t i = pred_offsets[node]; i < pred_offsets[node + 1]; i++)
+            {
+                if(dfnum[pred[i]] == none)
+                    continue;
+
+                uint32_t u = eval(dfnum[pred[i]]);
+                if(semi[u] < semi[w])
+                    semi[w] = semi[u];
+            }
+
+            bucket_next[w] = bucket_head[semi[w]];
+            bucket_head[semi[w]] = w;
+
+            uint32_t p = parent[w];
+            ancestor[w] = p;
+
+            for(uint32_t v = bucket_head[p]; v != none; v = bucket_next[v])
+            {
+                uint32_t u = eval(v);
+                idom[v] = semi[u] < semi[v] ? u : p;
+            }
+            bucket_head[p] = none;
+        }
+
+        idom[0] = 0;
+        for(uint32_t w = 1; w < n_reachable; w++)
+            if(idom[w] != semi[w])
+                idom[w] = idom[idom[w]];
+
+        _idom.assign(n_nodes, none);
+        _depth.assign(n_nodes, none);
+        _preorder.assign(n_nodes, none);
+        _subtree_size.assign(n_nodes, 0);
+
+        _depth[root] = 0;
+        for(uint32_t w = 1; w < n_reachable; w++)
+        {
+            _idom[_order[w]] = _order[idom[w]];
+            _depth[_order[w]] = _depth[_order[idom[w]]] + 1;
+        }
+
+        for(uint32_t w = n_reachable; w-- > 0;)
+        {
+            _subtree_size[_order[w]]++;
+            if(w != 0)
+                _subtree_size[_order[idom[w]]] += _subtree_size[_order[w]];
+        }
+
+        // Hand out the preorder ranges top-down: Each child takes the next free slots of its dominator's range
+        vector<uint32_t> next_free(n_reachable);
+        _preorder[root] = 0;
+        next_free[0] = 1;
+        for(uint32_t w = 1; w < n_reachable; w++)
+        {
+            uint32_t node = _order[w];
+            _preorder[node] = next_free[idom[w]];
+            next_free[idom[w]] += _subtree_size[node];
+            next_free[w] = _preorder[node] + 1;
+        }
+    }
+
+    [[nodiscard]] bool reachable(uint32_t node) const { return _depth[node] != none; }
+
+    // Only defined for reachable nodes other than the root
+    [[nodiscard]] uint32_t idom(uint32_t node) const { return _idom[node]; }
+
+    [[nodiscard]] uint32_t depth(uint32_t node) const { return _depth[node]; }
+
+    [[nodiscard]] span<const uint32_t> order() const { return _order; }
+
+    // Every node dominates itself
+    [[nodiscard]] bool dominates(uint32_t a, uint32_t b) const
+    {
+        return _preorder[a] <= _preorder[b] && _preorder[b] < _preorder[a] + _subtree_size[a];
+    }
+
+    [[nodiscard]] uint32_t nearest_common_dominator(uint32_t a, uint32_t b) const
+    {
+        while(_depth[a] > _depth[b])
+            a = _idom[a];
+        while(_depth[b] > _depth[a])
+            b = _idom[b];
+        while(a != b)
+        {
+            a = _idom[a];
+            b = _idom[b];
+        }
+        return a;
+    }
+};
+
+/* The causality graph as plain graph over the methods and typeflows that are live in the unpurged fixpoint:
+ * Every edge leads from a node to one that it may help reaching. The node ids of the methods come first, followed by the typeflows.
+ * Where a node needs several inputs at once, only one of them is marked as dominance edge:
+ * The later source of a hyperedge, and the dependent method of a typeflow instead of its predecessors.
+ * Every path of the unpurged fixpoint still has a counterpart along dominance edges,
+ * thus every node dominated by a method along them surely gets lost when that method is purged. */
+class SupportGraph
+{
+public:
+    enum class Kind : uint8_t
+    {
+        call,
+        hyperedge,
+        dependent,
+        typeflow,
+        virtual_invocation,
+        white_hole,
+    };
+
+private:
+    const Adjacency& adj;
+    const BFS<true>& r;
+    // Typeflows that got types and whose method got reached, i.e. those that propagated anything
+    vector<bool> active;
+
+public:
+    SupportGraph(const Adjacency& adj, const BFS<true>& r) : adj(adj), r(r), active(adj.n_typeflows())
+    {
+        active[0] = true;
+
+        for(size_t i = 1; i < adj.n_typeflows(); i++)
+        {
+            method_id dependent = adj.flows[i].method.dependent();
+            active[i] = r.typeflow_visited[i].any() && (!dependent || r.methods.visited(dependent));
+        }
+    }
+
+    [[nodiscard]] size_t n_nodes() const { return adj.n_methods() + adj.n_typeflows(); }
+
+    [[nodiscard]] uint32_t node(method_id m) const { return m.id; }
+
+    [[nodiscard]] uint32_t node(typeflow_id v) const { return adj.n_methods() + v.id; }
+
+    [[nodiscard]] bool is_method(uint32_t node) const { return node < adj.n_methods(); }
+
+    [[nodiscard]] bool is_active(typeflow_id v) const { return active[v.id]; }
+
+    template<typename F>
+    void for_each_successor(uint32_t n, F&& f) const
+    {
+        if(is_method(n))
+        {
+            method_id u = n;
+
+            if(!r.methods.visited(u))
+                return;
+
+            const auto& m = adj[u];
+
+            for(method_id v : m.forward_edges)
+                if(r.methods.visited(v))
+                    f(node(v), Kind::call, true);
+
+            for(hyperedge_id he : m.forward_hyperedges)
+            {
+                const auto& e = adj[he];
+
+                if(r.methods.visited(e.src1) && r.methods.visited(e.src2))
+                {
+                    method_id later_src = r.methods.dist(e.src2) > r.methods.dist(e.src1) ? e.src2 : e.src1;
+                    f(node(e.dst), Kind::hyperedge, u == later_src);
+                }
+            }
+
+            for(typeflow_id v : m.dependent_typeflows)
+                if(active[v.id])
+                    f(node(v), Kind::dependent, true);
+
+            if(u.id == 0)
+                f(node(typeflow_id(0)), Kind::white_hole, true);
+        }
+        else
+        {
+            typeflow_id v = n - adj.n_methods();
+
+            if(!active[v.id])
+                return;
+
+            for(typeflow_id w : adj[v].forward_edges)
+                if(active[w.id])
+                    f(node(w), Kind::typeflow, !adj[w].method.dependent());
+
+            method_id reaching = adj[v].method.reaching();
+
+            if(reaching && r.methods.visited(reaching))
+                f(node(reaching), Kind::virtual_invocation, true);
+        }
+    }
+};
+
+/* Dominator tree of the SupportGraph of the unpurged fixpoint.
+ * The costs dominated by a purge set are a lower bound for its PurgeGain. */
+class PurgeDominance
+{
+    static DominatorTree build_tree(const SupportGraph& g)
+    {
+        vector<uint32_t> succ_offsets(g.n_nodes() + 1);
+        vector<uint32_t> succ;
+
+        for(size_t n = 0; n < g.n_nodes(); n++)
+        {
+            g.for_each_successor(n, [&](uint32_t w, SupportGraph::Kind, bool dominance)
+            {
+                if(dominance)
+                    succ.push_back(w);
+            });
+            succ_offsets[n + 1] = succ.size();
+        }
+
+        return {0, succ_offsets, succ};
+    }
+
+public:
+    const Adjacency& adj;
+    BFS<true> all;
+    SupportGraph g;
+    DominatorTree dt;
+    // Costs of the methods in the subtree of each node, and of the types only instantiated within it
+    vector<uint64_t> dominated_costs;
+
+    explicit PurgeDominance(const Adjacency& adj) : adj(adj), all(BFS<true>::run(adj)), g(adj, all), dt(build_tree(g)), dominated_costs(g.n_nodes())
+    {
+        // A type gets lost with the nearest common dominator of the methods instantiating it
+        vector<uint32_t> instantiating(adj.n_types(), DominatorTree::none);
+
+        for(uint32_t n : dt.order())
+        {
+            if(!g.is_method(n))
+                continue;
+
+            dominated_costs[n] = adj.method_costs[n];
+
+            for(type_t t : adj.methods[n].instantiated_types)
+                instantiating[t] = instantiating[t] == DominatorTree::none ? n : dt.nearest_common_dominator(instantiating[t], n);
+        }
+
+        for(size_t t = 0; t < adj.n_types(); t++)
+            if(instantiating[t] != DominatorTree::none)
+                dominated_costs[instantiating[t]] += adj.type_costs[t];
+
+        for(size_t i = dt.order().size(); i-- > 1;)
+        {
+            uint32_t n = dt.order()[i];
+            dominated_costs[dt.idom(n)] += dominated_costs[n];
+        }
+    }
+
+    // g refers to all
+    PurgeDominance(const PurgeDominance&) = delete;
+
+    [[nodiscard]] uint64_t lower_bound(span<const method_id> purged) const
+    {
+        uint64_t cost = 0;
+
+        for(method_id m : purged)
+        {
+            if(!all.methods.visited(m))
+                continue;
+
+            // Subtrees of other purged methods are already accounted for by them
+            bool nested = std::any_of(purged.begin(), purged.end(), [&](method_id other)
+            {
+                return !(other == m) && all.methods.visited(other) && dt.dominates(g.node(other), g.node(m));
+            });
+
+            if(!nested)
+                cost += dominated_costs[m.id];
+        }
+
+        return cost;
+    }
+};
+
+/* PurgeGain of each single method, i.e. the summed up costs of what becomes unreachable by purging it (including itself, 0 for unreachable methods).
+ *
+ * The methods dominated by m in the SupportGraph are a lower bound for what gets lost by purging m.
+ * It is exact, if the rest of the fixpoint doesn't depend on the dominated part. This holds if nothing leaves it except
+ * for calls and virtual invocations into methods that also have a caller outside of it which got reached earlier,
+ * and if it contains no saturated typeflow, whose types would spread through allInstantiated.
+ * Then the types instantiated outside of it stay as well.
+ * The remaining methods get simulated with IncrementalBfs. */
+static vector<uint64_t> compute_singleton_purge_gains(const Adjacency& adj, size_t* n_simulated = nullptr)
+{
+    PurgeDominance d(adj);
+    const auto& all = d.all;
+    const auto& g = d.g;
+    const auto& dt = d.dt;
+
+    // Nearest common dominator of the callers that got reached before the method, which therefore can stand in for any other caller
+    vector<uint32_t> earlier_callers(adj.n_methods(), DominatorTree::none);
+    // The dists only reflect the order of the method levels as long as they didn't overflow
+    bool dists_ordered = all.stats.method_levels < MethodStates<true>::unreachable;
+
+    for(size_t i = 1; i < adj.n_methods(); i++)
+    {
+        if(!dists_ordered || !all.methods.visited(i))
+            continue;
+
+        for(method_id caller : adj.methods[i].backward_edges)
+        {
+            if(!all.methods.visited(caller) || all.methods.dist(caller) >= all.methods.dist(i))
+                continue;
+
+            uint32_t& callers = earlier_callers[i];
+            callers = callers == DominatorTree::none ? g.node(caller) : dt.nearest_common_dominator(callers, g.node(caller));
+        }
+    }
+
+    // A method m is inexact iff some node x dominated by m has min_inexact_depth[x] <= depth(m)
+    vector<uint32_t> min_inexact_depth(g.n_nodes(), DominatorTree::none);
+
+    for(uint32_t a : dt.order())
+    {
+        g.for_each_successor(a, [&](uint32_t b, SupportGraph::Kind kind, bool dominance)
+        {
+            // The root can't get lost
+            if(kind == SupportGraph::Kind::white_hole || b == 0)
+                return;
+
+            // The edge leaves the dominated set of exactly the dominators of a that don't dominate b.
+            // For dominance edges, idom(b) dominates a, which saves the search.
+            uint32_t common = dominance ? (dt.dominates(b, a) ? b : dt.idom(b)) : dt.nearest_common_dominator(a, b);
+            uint32_t from_depth = dt.depth(common) + 1;
+            uint32_t x = a;
+
+            if(kind == SupportGraph::Kind::call || kind == SupportGraph::Kind::virtual_invocation)
+            {
+                uint32_t callers = earlier_callers[b];
+
+                // Harmless unless the earlier callers get lost as well
+                if(callers != DominatorTree::none)
+                    x = dt.nearest_common_dominator(x, callers);
+            }
+
+            min_inexact_depth[x] = min(min_inexact_depth[x], from_depth);
+        });
+    }
+
+    for(size_t i = 1; i < adj.n_typeflows(); i++)
+        if(g.is_active(i) && all.typeflow_visited[i].is_saturated())
+            min_inexact_depth[g.node(typeflow_id(i))] = 0;
+
+    for(size_t i = dt.order().size(); i-- > 1;)
+    {
+        uint32_t n = dt.order()[i];
+        min_inexact_depth[dt.idom(n)] = min(min_inexact_depth[dt.idom(n)], min_inexact_depth[n]);
+    }
+
+    vector<uint64_t> gains(d.dominated_costs.begin(), d.dominated_costs.begin() + adj.n_methods());
+
+    vector<method_id> inexact;
+
+    for(size_t i = 1; i < adj.n_methods(); i++)
+        if(all.methods.visited(i) && min_inexact_depth[i] <= dt.depth(i))
+            inexact.push_back(i);
+
+    if(n_simulated)
+        *n_simulated = inexact.size();
+
+    vector<PurgeTreeNode> singletons(inexact.size());
+    for(size_t i = 0; i < inexact.size(); i++)
+        singletons[i] = {{&inexact[i], 1}, {}};
+
+    bfs_incremental_parallel(adj, singletons, [&](const PurgeTreeNode& node, const BFS<false>& r)
+    {
+        gains[node.mids[0].id] = all.reached_cost - r.reached_cost;
+    });
+
+    gains[0] = 0;
+    return gains;
+}
+
+#endif //CAUSALITY_GRAPH_DOMINATORS_H
@@ -13,6 +13,9 @@
 #include <ranges>
 #include <span>
 #include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
 #include "Bitset.h"
 
 using namespace std;
@@ -49,34 +52,89 @@ static void read_lines(vector<string>& dst, const uint8_t* data, size_t len)
     read_lines(dst, in);
 }
 
-static void read_typestate_bitsets(size_t num_types, vector<Bitset>& typestates, istream& in, size_t inlen)
+/* Array allocated with malloc(), freed on destruction.
+ * This allows adopting the buffers the JS side allocated in the WASM heap instead of copying them. */
+template<typename T>
+class MallocBuffer
 {
-    size_t bitset_len = (num_types + 7) / 8;
-    size_t n = inlen / bitset_len;
-    assert((inlen % bitset_len) == 0);
-    typestates.reserve(n);
+    static_assert(is_trivially_copyable_v<T>);
 
-    for(size_t i = 0; i < n; i++)
+    struct free_deleter
+    {
+        void operator()(T* p) const { free(p); }
+    };
+
+    unique_ptr<T[], free_deleter> _data;
+    size_t _size = 0;
+
+public:
+    MallocBuffer() = default;
+
+    // Takes ownership of len bytes at data, which must have been allocated with malloc()
+    MallocBuffer(void* data, size_t len) : _data((T*)data), _size(len / sizeof(T))
+    {
+        assert((len % sizeof(T)) == 0);
+    }
+
+    explicit MallocBuffer(size_t size) : _data((T*)calloc(max(size, (size_t)1), sizeof(T))), _size(size)
     {
-        typestates.emplace_back(num_types);
-        typestates.back().fill(in);
+        if(!_data)
+            throw bad_alloc();
     }
+
+    [[nodiscard]] T* data() { return _data.get(); }
+    [[nodiscard]] const T* data() const { return _data.get(); }
+    [[nodiscard]] size_t size() const { return _size; }
+    [[nodiscard]] bool empty() const { return _size == 0; }
+
+    [[nodiscard]] T& operator[](size_t i) { return _data[i]; }
+    [[nodiscard]] const T& operator[](size_t i) const { return _data[i]; }
+
+    [[nodiscard]] const T& at(size_t i) const
+    {
+        if(i >= _size)
+            throw out_of_range("MallocBuffer::at");
+        return _data[i];
+    }
+
+    [[nodiscard]] T* begin() { return data(); }
+    [[nodiscard]] T* end() { return data() + _size; }
+    [[nodiscard]] const T* begin() const { return data(); }
+    [[nodiscard]] const T* end() const { return data() + _size; }
+
+    operator span<const T>() const { return {data(), _size}; }
+};
+
+/* Typestates are stored as one row per typestate, each padded to whole words such that the Bitsets can refer to them.
+ * The export has rows of whole bytes instead, which get padded while reading them. */
+static void read_typestate_bitsets(size_t num_types, MallocBuffer<uint64_t>& blocks, vector<Bitset>& typestates)
+{
+    size_t row_len = Bitset::blocks_for(num_types);
+    assert(row_len == 0 || (blocks.size() % row_len) == 0);
+    size_t n = row_len ? blocks.size() / row_len : 0;
+    typestates.reserve(n);
+
+    for(size_t i = 0; i < n; i++)
+        typestates.emplace_back(blocks.data() + i * row_len, num_types);
 }
 
-static void read_typestate_bitsets(size_t num_types, vector<Bitset>& typestates, const char* path)
+static void read_typestate_bitsets(size_t num_types, MallocBuffer<uint64_t>& blocks, vector<Bitset>& typestates, const char* path)
 {
     ifstream in(path);
     in.seekg(0, ifstream::end);
     size_t inlen = in.tellg();
     in.seekg(0);
-    read_typestate_bitsets(num_types, typestates, in, inlen);
-}
 
-static void read_typestate_bitsets(size_t num_types, vector<Bitset>& typestates, const uint8_t* data, size_t len)
-{
-    wrap_vector_as_istream databuf(span<const uint8_t>(data, len));
-    std::istream in(&databuf);
-    read_typestate_bitsets(num_types, typestates, in, len);
+    size_t bitset_len = (num_types + 7) / 8;
+    size_t row_len = Bitset::blocks_for(num_types);
+    size_t n = inlen / bitset_len;
+    assert((inlen % bitset_len) == 0);
+
+    blocks = MallocBuffer<uint64_t>(n * row_len);
+    for(size_t i = 0; i < n; i++)
+        in.read((char*)(blocks.data() + i * row_len), bitset_len);
+
+    read_typestate_bitsets(num_types, blocks, typestates);
 }
 
 
@@ -109,4 +167,25 @@ static void read_buffer(vector<T>& dst, const uint8_t* data, size_t len)
     read_buffer(dst, in, len);
 }
 
+template<typename T>
+static void read_buffer(MallocBuffer<T>& dst, const char* path)
+{
+    ifstream in(path);
+    in.seekg(0, ifstream::end);
+    size_t len = in.tellg();
+    in.seekg(0);
+
+    assert((len % sizeof(T)) == 0);
+    dst = MallocBuffer<T>(len / sizeof(T));
+    in.read((char*)dst.data(), len);
+}
+
+// Appends the contents of an adopted buffer, which gets freed right after
+template<typename T>
+static void read_buffer(vector<T>& dst, MallocBuffer<T>&& src)
+{
+    MallocBuffer<T> consumed = std::move(src);
+    dst.insert(dst.end(), consumed.begin(), consumed.end());
+}
+
 #endif //CAUSALITY_GRAPH_INPUT_H
@@ -8,9 +8,11 @@
 #include <cstdint>
 #include <unordered_map>
 #include "Bitset.h"
+#include "input.h"
 #include <span>
 #include <queue>
 #include <cassert>
+#include <algorithm>
 
 using namespace std;
 
@@ -230,23 +232,45 @@ struct Adjacency
         vector<hyperedge_id> backward_hyperedges;
         vector<typeflow_id> dependent_typeflows;
         vector<typeflow_id> virtual_invocation_sources;
+        // Types with costs that get instantiated while the method is reached, i.e. that the white hole feeds
+        // into its dependent typeflows. The root stands in for typeflows without a dependent method.
+        vector<type_t> instantiated_types;
 
         MethodInfo() = default;
         MethodInfo(const MethodInfo& o) = delete;
     };
 
     size_t _n_types;
+    size_t _n_direct_invokes;
     vector<TypeflowInfo> flows;
     vector<MethodInfo> methods;
     vector<HyperEdge<method_id>> hyper_edges;
+    // Cost of each method and type, as used for PurgeGain in subuniverse-reachability.md.
+    // A type counts while some reached method instantiates it, see MethodInfo::instantiated_types.
+    // Unless given, methods cost 1 and types 0, such that gains count the purged methods.
+    vector<uint32_t> method_costs;
+    vector<uint32_t> type_costs;
 
     // Data used for batched saturation
     const Bitset* filters_begin = nullptr;
     vector<TypeSet> filter_filters;
+    // Inverted index of filter_filters: For every type the ids of the filters that admit it.
+    // Only covers filters that are in use by some typeflow.
+    vector<vector<uint32_t>> filters_by_type;
 
-    Adjacency(size_t n_types, size_t n_methods, size_t n_typeflows, const vector<Edge<typeflow_id>>& interflows, const vector<Edge<method_id>>& direct_invokes, const vector<Bitset>& typestates, const vector<uint32_t>& typeflow_filters, const vector<ContainingMethod>& typeflow_methods, const vector<string>& typeflow_names, vector<HyperEdge<method_id>>&& hyper_edges)
-            : _n_types(n_types), flows(n_typeflows), methods(n_methods), hyper_edges(std::move(hyper_edges))
+    // typeflow_filters and typeflow_methods start at typeflow 1, since typeflow 0 isn't part of the input
+    Adjacency(size_t n_types, size_t n_methods, size_t n_typeflows, span<const Edge<typeflow_id>> interflows, span<const Edge<method_id>> direct_invokes, const vector<Bitset>& typestates, span<const uint32_t> typeflow_filters, span<const ContainingMethod> typeflow_methods, const vector<string>& typeflow_names, vector<HyperEdge<method_id>>&& hyper_edges, vector<uint32_t>&& method_costs, vector<uint32_t>&& type_costs)
+            : _n_types(n_types), _n_direct_invokes(direct_invokes.size()), flows(n_typeflows), methods(n_methods), hyper_edges(std::move(hyper_edges)), method_costs(std::move(method_costs)), type_costs(std::move(type_costs))
     {
+        // The root method always has an entry, since it isn't part of the input
+        if(this->method_costs.size() <= 1)
+            this->method_costs.assign(n_methods, 1);
+        if(this->type_costs.empty())
+            this->type_costs.assign(n_types, 0);
+
+        assert(this->method_costs.size() == n_methods);
+        assert(this->type_costs.size() == n_types);
+
         vector<TypeSet> typestates_compressed;
         typestates_compressed.reserve(typestates.size());
 
@@ -264,13 +288,13 @@ struct Adjacency
             methods[e.src.id].forward_edges.push_back(e.dst);
             methods[e.dst.id].backward_edges.push_back(e.src);
         }
-        for(size_t flow = 0; flow < typeflow_methods.size(); flow++)
+        for(size_t flow = 1; flow <= typeflow_methods.size(); flow++)
         {
-            flows[flow].method = typeflow_methods[flow];
-            if(typeflow_methods[flow].dependent())
-                methods[typeflow_methods[flow].dependent().id].dependent_typeflows.push_back(flow);
-            if(typeflow_methods[flow].reaching())
-                methods[typeflow_methods[flow].reaching().id].virtual_invocation_sources.push_back(flow);
+            flows[flow].method = typeflow_methods[flow - 1];
+            if(flows[flow].method.dependent())
+                methods[flows[flow].method.dependent().id].dependent_typeflows.push_back(flow);
+            if(flows[flow].method.reaching())
+                methods[flows[flow].method.reaching().id].virtual_invocation_sources.push_back(flow);
         }
 
         for(size_t i = 0; i < this->hyper_edges.size(); i++)
@@ -281,10 +305,21 @@ struct Adjacency
             methods[he.dst.id].backward_hyperedges.push_back(i);
         }
 
-        for(size_t i = 1; i < typeflow_filters.size(); i++)
+        for(size_t i = 1; i <= typeflow_filters.size(); i++)
+        {
+            flows[i].original_filter = &typestates.at(typeflow_filters[i - 1]);
+            flows[i].filter = typestates_compressed.at(typeflow_filters[i - 1]);
+        }
+
+        // Taken from the input, so that neither the typeflow optimization nor the propagation order affect it
+        for(typeflow_id v : flows[0].forward_edges)
         {
-            flows[i].original_filter = &typestates.at(typeflow_filters[i]);
-            flows[i].filter = typestates_compressed.at(typeflow_filters[i]);
+            auto& types = methods[flows[v.id].method.dependent().id].instantiated_types;
+            TypeSet filter = flows[v.id].filter;
+
+            for(size_t t = filter.first(); t < n_types; t = filter.next(t))
+                if(this->type_costs[t])
+                    types.push_back(t);
         }
 
 #if INCLUDE_LABELS
@@ -308,6 +343,10 @@ struct Adjacency
             m.backward_hyperedges.shrink_to_fit();
             m.virtual_invocation_sources.shrink_to_fit();
             m.dependent_typeflows.shrink_to_fit();
+
+            std::sort(m.instantiated_types.begin(), m.instantiated_types.end());
+            m.instantiated_types.erase(std::unique(m.instantiated_types.begin(), m.instantiated_types.end()), m.instantiated_types.end());
+            m.instantiated_types.shrink_to_fit();
         }
 
         {
@@ -326,6 +365,27 @@ struct Adjacency
 
             for(size_t i = 0; i < filters_end - filters_begin; i++)
                 filter_filters.emplace_back(&filters_begin[i]);
+
+            vector<bool> filter_used(filter_filters.size());
+
+            for(size_t i = 1; i < flows.size(); i++)
+                filter_used[flows[i].original_filter - filters_begin] = true;
+
+            filters_by_type.resize(n_types);
+
+            for(size_t filter_id = 0; filter_id < filter_filters.size(); filter_id++)
+            {
+                if(!filter_used[filter_id])
+                    continue;
+
+                TypeSet filter = filter_filters[filter_id];
+
+                for(size_t t = filter.first(); t < n_types; t = filter.next(t))
+                    filters_by_type[t].push_back(filter_id);
+            }
+
+            for(auto& filters : filters_by_type)
+                filters.shrink_to_fit();
         }
     }
 
@@ -337,6 +397,8 @@ struct Adjacency
 
     [[nodiscard]] size_t n_hyperedges() const { return hyper_edges.size(); }
 
+    [[nodiscard]] size_t n_direct_invokes() const { return _n_direct_invokes; }
+
     [[nodiscard]] MethodInfo& operator[](method_id id) { return methods[(uint32_t)id]; }
     [[nodiscard]] const MethodInfo& operator[](method_id id) const { return methods[(uint32_t)id]; }
 
@@ -369,10 +431,18 @@ struct Adjacency
             complete_size += m.virtual_invocation_sources.capacity() * sizeof(typeflow_id);
             complete_size += m.forward_hyperedges.capacity() * sizeof(hyperedge_id);
             complete_size += m.backward_hyperedges.capacity() * sizeof(hyperedge_id);
+            complete_size += m.instantiated_types.capacity() * sizeof(type_t);
         }
 
+        complete_size += method_costs.capacity() * sizeof(uint32_t);
+        complete_size += type_costs.capacity() * sizeof(uint32_t);
+
         complete_size += hyper_edges.capacity() * sizeof(HyperEdge<method_id>);
 
+        complete_size += filters_by_type.capacity() * sizeof(vector<uint32_t>);
+        for(const auto& filters : filters_by_type)
+            complete_size += filters.capacity() * sizeof(uint32_t);
+
         return complete_size;
     }
 };
@@ -425,8 +495,9 @@ static bool can_be_contracted(const Adjacency& adj, typeflow_id typeflow)
            && std::all_of(f.forward_edges.begin(), f.forward_edges.end(), [&adj, &f](typeflow_id next){ return f.filter.is_superset(adj[next].filter); });
 }
 
-// Returns the number of iterations
-static size_t contract_typeflow_nodes(Adjacency& adj, vector<bool>& redundant_typeflows)
+// Returns the number of iterations.
+// Edges that now also stand for a path through a contracted typeflow get appended to merged_edges.
+static size_t contract_typeflow_nodes(Adjacency& adj, vector<bool>& redundant_typeflows, vector<Edge<typeflow_id>>& merged_edges)
 {
     size_t iterations = 0;
     size_t useless_iterations = 0;
@@ -452,7 +523,12 @@ static size_t contract_typeflow_nodes(Adjacency& adj, vector<bool>& redundant_ty
 
                 for(auto next : f.forward_edges)
                 {
-                    if(next != prev && std::find(adj[prev].forward_edges.begin(), adj[prev].forward_edges.end(), next) == adj[prev].forward_edges.end())
+                    if(next == prev)
+                        continue;
+
+                    merged_edges.push_back({prev, next});
+
+                    if(std::find(adj[prev].forward_edges.begin(), adj[prev].forward_edges.end(), next) == adj[prev].forward_edges.end())
                     {
                         adj[prev].forward_edges.push_back(next);
                         adj[next].backward_edges.push_back(prev);
@@ -487,12 +563,32 @@ static size_t contract_typeflow_nodes(Adjacency& adj, vector<bool>& redundant_ty
     return iterations;
 }
 
-static void remove_redundant(Adjacency& adj)
+// Where the typeflows of the input ended up after remove_redundant()
+struct TypeflowRemapping
+{
+    static constexpr int32_t without_sideeffects = -1;
+    static constexpr int32_t contracted = -2;
+
+    // New id of every input typeflow, or one of the above if it got removed. Empty means identity.
+    vector<int32_t> ids;
+    // Remaining edges that also stand for a path through a contracted typeflow, sorted by edge_less
+    vector<Edge<typeflow_id>> merged_edges;
+
+    static bool edge_less(Edge<typeflow_id> a, Edge<typeflow_id> b)
+    {
+        return pair(a.src.id, a.dst.id) < pair(b.src.id, b.dst.id);
+    }
+};
+
+static TypeflowRemapping remove_redundant(Adjacency& adj)
 {
     vector<bool> redundant_typeflows = calc_typeflows_without_sideeffects(adj);
 
     redundant_typeflows[0] = false; // Fix for if we have no typeflow information, still keep the ultimate source (0)
 
+    vector<bool> without_sideeffects = redundant_typeflows;
+    vector<Edge<typeflow_id>> merged_edges;
+
     // Batch remove
     {
         auto is_redundant = [&redundant_typeflows](typeflow_id w){ return redundant_typeflows[w.id]; };
@@ -523,7 +619,7 @@ static void remove_redundant(Adjacency& adj)
     }
 
     size_t iterations = 0;
-    iterations = contract_typeflow_nodes(adj, redundant_typeflows);
+    iterations = contract_typeflow_nodes(adj, redundant_typeflows, merged_edges);
     size_t redundant_typeflows_count = std::count(redundant_typeflows.begin(), redundant_typeflows.end(), true);
 
 #if LOG || 1
@@ -591,6 +687,31 @@ static void remove_redundant(Adjacency& adj)
     }
 
     adj.flows = std::move(new_flows);
+
+    TypeflowRemapping remapping;
+    remapping.ids.resize(typeflow_remapping.size());
+
+    for(size_t i = 0; i < typeflow_remapping.size(); i++)
+    {
+        if(!redundant_typeflows[i])
+            remapping.ids[i] = typeflow_remapping[i];
+        else
+            remapping.ids[i] = without_sideeffects[i] ? TypeflowRemapping::without_sideeffects : TypeflowRemapping::contracted;
+    }
+
+    // Merges involving typeflows that got contracted later on don't matter anymore
+    erase_if(merged_edges, [&](Edge<typeflow_id> e) { return redundant_typeflows[e.src.id] || redundant_typeflows[e.dst.id]; });
+
+    for(auto& e : merged_edges)
+    {
+        remap(e.src);
+        remap(e.dst);
+    }
+
+    std::sort(merged_edges.begin(), merged_edges.end(), TypeflowRemapping::edge_less);
+    remapping.merged_edges = std::move(merged_edges);
+
+    return remapping;
 }
 
 struct model_data
@@ -598,14 +719,46 @@ struct model_data
     vector<string> type_names;
     vector<string> method_names;
     vector<string> typeflow_names;
+    // The typestates refer to typestate_blocks
+    MallocBuffer<uint64_t> typestate_blocks;
     vector<Bitset> typestates;
-    vector<Edge<typeflow_id>> interflows;
-    vector<Edge<method_id>> direct_invokes;
-    vector<ContainingMethod> containing_methods;
-    vector<uint32_t> typeflow_filters;
+    MallocBuffer<Edge<typeflow_id>> interflows;
+    MallocBuffer<Edge<method_id>> direct_invokes;
+    // Starting at typeflow 1, see Adjacency
+    MallocBuffer<ContainingMethod> containing_methods;
+    MallocBuffer<uint32_t> typeflow_filters;
     vector<HyperEdge<method_id>> hyper_edges;
+    // Optional, see Adjacency. The input method costs get appended to the cost of the root, so they exclude it.
+    vector<uint32_t> method_costs;
+    vector<uint32_t> type_costs;
+
+    model_data() : method_names(1), typeflow_names(1), method_costs(1) {}
+
+    // Costs have to be either absent, or given for every method and type
+    [[nodiscard]] bool costs_match() const
+    {
+        return (method_costs.size() == 1 || method_costs.size() == method_names.size())
+            && (type_costs.empty() || type_costs.size() == type_names.size());
+    }
+};
 
-    model_data() : method_names(1), typeflow_names(1), typeflow_filters(1), containing_methods(1) {}
+// Where an edge of the input is located in the Adjacency
+template<typename Id>
+struct ResolvedEdge
+{
+    enum class Kind
+    {
+        // In the Adjacency, where its parallel copies resolve to the same edge
+        present,
+        // Removing it can't change anything, because it leads into a typeflow without side effects
+        without_effect,
+        // It got merged with other edges when redundant typeflows got contracted, and can't be told apart from them
+        contracted,
+        // It leads from the white hole to types with costs, which stay instantiated when masking it
+        instantiating,
+    } kind;
+
+    Edge<Id> edge;
 };
 
 struct model
@@ -613,9 +766,16 @@ struct model
     vector<string> type_names;
     vector<string> method_names;
     vector<string> typeflow_names;
+    MallocBuffer<uint64_t> typestate_blocks;
     vector<Bitset> typestates;
+    // Kept for resolving the ids of input edges
+    MallocBuffer<Edge<typeflow_id>> interflows;
+    MallocBuffer<Edge<method_id>> direct_invokes;
+    // Input typeflows that the white hole feeds types with costs into, see Adjacency::MethodInfo::instantiated_types
+    vector<bool> instantiating_typeflows;
 
     Adjacency adj;
+    TypeflowRemapping typeflow_remapping;
 
     unordered_map<string, uint32_t> method_ids_by_name;
 
@@ -626,8 +786,11 @@ public:
         method_names(std::move(data.method_names)),
         type_names(std::move(data.type_names)),
         typeflow_names(std::move(data.typeflow_names)),
+        typestate_blocks(std::move(data.typestate_blocks)),
         typestates(std::move(data.typestates)),
-        adj(type_names.size(), method_names.size(), typeflow_names.size(), data.interflows, data.direct_invokes, this->typestates, data.typeflow_filters, data.containing_methods, typeflow_names, std::move(data.hyper_edges))
+        interflows(std::move(data.interflows)),
+        direct_invokes(std::move(data.direct_invokes)),
+        adj(type_names.size(), method_names.size(), typeflow_names.size(), this->interflows, this->direct_invokes, this->typestates, data.typeflow_filters, data.containing_methods, typeflow_names, std::move(data.hyper_edges), std::move(data.method_costs), std::move(data.type_costs))
     {
         {
             size_t i = 0;
@@ -635,8 +798,16 @@ public:
                 method_ids_by_name[name] = i++;
         }
 
+        instantiating_typeflows.resize(adj.n_typeflows());
+        for(typeflow_id v : adj.flows[0].forward_edges)
+        {
+            TypeSet filter = adj[v].filter;
+            for(size_t t = filter.first(); t < adj.n_types(); t = filter.next(t))
+                instantiating_typeflows[v.id] = instantiating_typeflows[v.id] || adj.type_costs[t];
+        }
+
         size_t max_typestate_size = 0;
-        for(Bitset& typestate : typestates)
+        for(const Bitset& typestate : typestates)
             max_typestate_size = max(max_typestate_size, typestate.count());
 
 #if LOG
@@ -646,16 +817,74 @@ public:
 
     void optimize()
     {
-        remove_redundant(adj);
+        TypeflowRemapping remapping = remove_redundant(adj);
+
+        // Repeated optimization refers to the typeflows that remained after the previous one
+        if(!typeflow_remapping.ids.empty())
+        {
+            for(int32_t& id : typeflow_remapping.ids)
+                if(id >= 0)
+                    id = remapping.ids[id];
+
+            for(Edge<typeflow_id> e : typeflow_remapping.merged_edges)
+            {
+                int32_t src = remapping.ids[e.src.id];
+                int32_t dst = remapping.ids[e.dst.id];
+
+                if(src >= 0 && dst >= 0)
+                    remapping.merged_edges.push_back({(uint32_t)src, (uint32_t)dst});
+            }
+
+            std::sort(remapping.merged_edges.begin(), remapping.merged_edges.end(), TypeflowRemapping::edge_less);
+            remapping.ids = std::move(typeflow_remapping.ids);
+        }
+
+        typeflow_remapping = std::move(remapping);
+    }
+
+    [[nodiscard]] ResolvedEdge<method_id> resolve_direct_invoke(size_t index) const
+    {
+        return {ResolvedEdge<method_id>::Kind::present, direct_invokes.at(index)};
     }
 
-    size_t used_memory_size()
+    [[nodiscard]] ResolvedEdge<typeflow_id> resolve_interflow(size_t index) const
     {
-        size_t size = adj.used_memory_size();
-        for(const auto& typestate: typestates)
+        using Kind = ResolvedEdge<typeflow_id>::Kind;
+
+        Edge<typeflow_id> e = interflows.at(index);
+
+        if(e.src.id == 0 && instantiating_typeflows[e.dst.id])
+            return {Kind::instantiating, e};
+
+        if(!typeflow_remapping.ids.empty())
         {
-            size += (typestate.size() + 7) / 8;
+            int32_t src = typeflow_remapping.ids[e.src.id];
+            int32_t dst = typeflow_remapping.ids[e.dst.id];
+
+            // Successors of typeflows without sideeffects also are without sideeffects
+            if(dst == TypeflowRemapping::without_sideeffects)
+                return {Kind::without_effect, e};
+            if(src < 0 || dst < 0)
+                return {Kind::contracted, e};
+
+            e = {(uint32_t)src, (uint32_t)dst};
+
+            const auto& merged = typeflow_remapping.merged_edges;
+            if(std::binary_search(merged.begin(), merged.end(), e, TypeflowRemapping::edge_less))
+                return {Kind::contracted, e};
         }
+
+        return {Kind::present, e};
+    }
+
+    size_t used_memory_size()
+    {
+        size_t size = adj.used_memory_size();
+        size += typestate_blocks.size() * sizeof(uint64_t);
+        size += typestates.capacity() * sizeof(Bitset);
+        size += interflows.size() * sizeof(Edge<typeflow_id>);
+        size += direct_invokes.size() * sizeof(Edge<method_id>);
+        size += (instantiating_typeflows.capacity() + 7) / 8;
         return size;
     }
 };
@@ -0,0 +1,318 @@
+#ifndef CAUSALITY_GRAPH_PARALLEL_H
+#define CAUSALITY_GRAPH_PARALLEL_H
+
+#include <vector>
+#include <span>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include "analysis.h"
+
+using namespace std;
+
+// Number of threads to use if the caller doesn't specify it
+static size_t default_thread_count()
+{
+    return max(1u, std::thread::hardware_concurrency());
+}
+
+/* Splits a purge tree into independent shares for parallel incremental simulation.
+ * A list of several purges gets split into contiguous sublists.
+ * The children of a single purge get split instead. Each share then has a copy of the root as its own root,
+ * which purges the mids of the root except those of the children in other shares.
+ * The results of these copies are meaningless, the root itself has to be simulated separately.
+ * Either way, concatenating the results of the shares in order yields the results of a single IncrementalBfs
+ * over the whole tree, which visits it in preorder. */
+class PurgeTreeSplit
+{
+    span<const PurgeTreeNode> purges;
+    // Copies of the root with a part of its children each, only used when splitting below a single root
+    vector<PurgeTreeNode> roots;
+    vector<vector<method_id>> root_mids;
+    vector<span<const PurgeTreeNode>> _shares;
+
+    static size_t subtree_size(span<const PurgeTreeNode> nodes)
+    {
+        size_t size = nodes.size();
+        for(const PurgeTreeNode& node : nodes)
+            size += subtree_size(node.children);
+        return size;
+    }
+
+    // Contiguous ranges of about equal numbers of simulations
+    static vector<span<const PurgeTreeNode>> split(span<const PurgeTreeNode> nodes, size_t n_shares)
+    {
+        vector<size_t> sizes(nodes.size());
+        size_t total = 0;
+        for(size_t i = 0; i < nodes.size(); i++)
+            total += sizes[i] = 1 + subtree_size(nodes[i].children);
+
+        vector<span<const PurgeTreeNode>> ranges;
+        size_t begin = 0;
+        size_t accumulated = 0;
+
+        for(size_t i = 0; i < nodes.size(); i++)
+        {
+            accumulated += sizes[i];
+
+            if(accumulated * n_shares >= total * (ranges.size() + 1) || i + 1 == nodes.size())
+            {
+                ranges.push_back(nodes.subspan(begin, i + 1 - begin));
+                begin = i + 1;
+            }
+        }
+
+        return ranges;
+    }
+
+public:
+    PurgeTreeSplit(span<const PurgeTreeNode> purges, size_t n_shares) : purges(purges)
+    {
+        if(purges.size() == 1)
+        {
+            auto children = split(purges[0].children, n_shares);
+            if(children.empty())
+                children.emplace_back();
+
+            // The mids of a node include those of its subtree, so each root leaves out those of the other shares
+            root_mids.resize(children.size());
+            roots.reserve(children.size());
+            for(size_t i = 0; i < children.size(); i++)
+            {
+                vector<method_id> others;
+                for(size_t j = 0; j < children.size(); j++)
+                    if(j != i)
+                        for(const PurgeTreeNode& child : children[j])
+                            others.insert(others.end(), child.mids.begin(), child.mids.end());
+                auto less = [](method_id a, method_id b) { return a.id < b.id; };
+                std::sort(others.begin(), others.end(), less);
+
+                for(method_id mid : purges[0].mids)
+                    if(!std::binary_search(others.begin(), others.end(), mid, less))
+                        root_mids[i].push_back(mid);
+
+                roots.push_back({root_mids[i], children[i]});
+            }
+            for(const PurgeTreeNode& root : roots)
+                _shares.emplace_back(&root, 1);
+        }
+        else
+        {
+            _shares = split(purges, n_shares);
+        }
+    }
+
+    PurgeTreeSplit(const PurgeTreeSplit&) = delete;
+    PurgeTreeSplit& operator=(const PurgeTreeSplit&) = delete;
+
+    [[nodiscard]] span<const span<const PurgeTreeNode>> shares() const { return _shares; }
+
+    // The purge that has to be simulated separately before the shares, if any
+    [[nodiscard]] const PurgeTreeNode* root() const
+    {
+        return roots.empty() ? nullptr : purges.data();
+    }
+
+    // Returns nullptr for the copies of the root, whose results have to be skipped
+    [[nodiscard]] const PurgeTreeNode* original(size_t share, const PurgeTreeNode* node) const
+    {
+        return !roots.empty() && node == _shares[share].data() ? nullptr : node;
+    }
+};
+
+/* Like bfs_incremental, but simulating the shares of a PurgeTreeSplit on separate threads.
+ * The callback invocations are serialized, but come in no particular order.
+ * Returns the stats accumulated over all threads. */
+static BFS<false>::Stats bfs_incremental_parallel(const Adjacency& adj, span<const PurgeTreeNode> methods_to_purge, const function<void(const PurgeTreeNode&, const BFS<false>&)>& callback, size_t n_threads = default_thread_count(), const EdgeOverlay* overlay = nullptr)
+{
+    // Each thread redoes the initial simulation, which only pays off with enough purges to share
+    if(n_threads <= 1 || (methods_to_purge.size() < 2 * n_threads && methods_to_purge.size() != 1))
+        return bfs_incremental(adj, methods_to_purge, callback, overlay);
+
+    PurgeTreeSplit split(methods_to_purge, n_threads);
+    vector<BFS<false>::Stats> stats(split.shares().size());
+    mutex callback_mutex;
+
+    if(const PurgeTreeNode* root = split.root())
+        callback(*root, BFS<false>::run(adj, root->mids, overlay));
+
+    auto work = [&](size_t share)
+    {
+        IncrementalBfs ibfs(adj, split.shares()[share], overlay);
+        while(auto n = ibfs.next())
+        {
+            if(const PurgeTreeNode* node = split.original(share, n))
+            {
+                lock_guard lock(callback_mutex);
+                callback(*node, ibfs.current_result());
+            }
+        }
+        stats[share] = ibfs.current_result().stats;
+    };
+
+    {
+        vector<jthread> threads;
+        for(size_t i = 1; i < split.shares().size(); i++)
+            threads.emplace_back(work, i);
+        work(0);
+    }
+
+    BFS<false>::Stats total{};
+    for(const auto& s : stats)
+    {
+        total.typeflow_pops += s.typeflow_pops;
+        total.typeflow_pushes_deduplicated += s.typeflow_pushes_deduplicated;
+        total.method_levels += s.method_levels;
+        total.method_levels_bottom_up += s.method_levels_bottom_up;
+        total.method_visits += s.method_visits;
+    }
+    return total;
+}
+
+/* Pull-based parallel replacement of IncrementalBfs, returning the results in the same order.
+ * Each share of a PurgeTreeSplit gets simulated on its own thread, which copies its results into a queue.
+ * The queues of later shares fill up while the earlier ones are being consumed, up to max_buffered results each.
+ * Without any threads, the purges get simulated on the calling thread. */
+class ParallelIncrementalBfs
+{
+public:
+    struct Step
+    {
+        const PurgeTreeNode* node;
+        MethodStates<false> methods;
+        uint64_t reached_cost;
+    };
+
+private:
+    struct Share
+    {
+        mutex m;
+        condition_variable changed;
+        deque<Step> steps;
+        bool done = false;
+    };
+
+    PurgeTreeSplit split;
+    size_t max_buffered;
+    vector<unique_ptr<Share>> queues;
+    atomic<bool> cancelled = false;
+    size_t current_share = 0;
+    optional<Step> current;
+    optional<IncrementalBfs> inline_bfs;
+    // Declared last, such that the threads get joined before the state they use is destroyed
+    vector<jthread> threads;
+
+    void produce(const Adjacency& adj, size_t share, const EdgeOverlay* overlay)
+    {
+        Share& q = *queues[share];
+
+        auto push = [&](const PurgeTreeNode* node, const BFS<false>& r)
+        {
+            Step step{node, r.methods, r.reached_cost};
+
+            unique_lock lock(q.m);
+            q.changed.wait(lock, [&] { return cancelled || q.steps.size() < max_buffered; });
+            if(cancelled)
+                return false;
+            q.steps.push_back(std::move(step));
+            q.changed.notify_all();
+            return true;
+        };
+
+        const PurgeTreeNode* root = split.root();
+        if(share == 0 && root && !push(root, BFS<false>::run(adj, root->mids, overlay, &cancelled)))
+            return;
+
+        IncrementalBfs ibfs(adj, split.shares()[share], overlay, &cancelled);
+
+        while(auto n = ibfs.next())
+            if(const PurgeTreeNode* node = split.original(share, n); node && !push(node, ibfs.current_result()))
+                return;
+
+        lock_guard lock(q.m);
+        q.done = true;
+        q.changed.notify_all();
+    }
+
+public:
+    ParallelIncrementalBfs(const Adjacency& adj, span<const PurgeTreeNode> purges, size_t n_threads = default_thread_count(), size_t max_buffered = 1024, const EdgeOverlay* overlay = nullptr)
+            : split(purges, max((size_t)1, n_threads)), max_buffered(max((size_t)1, max_buffered))
+    {
+        if(n_threads == 0)
+        {
+            inline_bfs.emplace(adj, purges, overlay, &cancelled);
+            return;
+        }
+
+        for(size_t i = 0; i < split.shares().size(); i++)
+            queues.push_back(make_unique<Share>());
+        for(size_t i = 0; i < split.shares().size(); i++)
+            threads.emplace_back(&ParallelIncrementalBfs::produce, this, std::cref(adj), i, overlay);
+    }
+
+    ParallelIncrementalBfs(const ParallelIncrementalBfs&) = delete;
+    ParallelIncrementalBfs& operator=(const ParallelIncrementalBfs&) = delete;
+
+    ~ParallelIncrementalBfs()
+    {
+        cancel();
+    }
+
+    // Stops the simulations, including the runs in progress. next() returns nullptr afterwards.
+    void cancel()
+    {
+        cancelled = true;
+        for(auto& q : queues)
+        {
+            lock_guard lock(q->m);
+            q->changed.notify_all();
+        }
+    }
+
+    // Returns nullptr once all purges have been simulated
+    const PurgeTreeNode* next()
+    {
+        current.reset();
+
+        if(cancelled)
+            return nullptr;
+
+        if(inline_bfs)
+        {
+            const PurgeTreeNode* node = inline_bfs->next();
+            if(node)
+                current = Step{node, inline_bfs->current_result().methods, inline_bfs->current_result().reached_cost};
+            return node;
+        }
+
+        for(; current_share < queues.size(); current_share++)
+        {
+            Share& q = *queues[current_share];
+            unique_lock lock(q.m);
+            q.changed.wait(lock, [&] { return q.done || !q.steps.empty(); });
+
+            if(!q.steps.empty())
+            {
+                current = std::move(q.steps.front());
+                q.steps.pop_front();
+                q.changed.notify_all();
+                return current->node;
+            }
+        }
+
+        return nullptr;
+    }
+
+    // Result of the last purge returned by next()
+    [[nodiscard]] const Step& current_result() const
+    {
+        return *current;
+    }
+};
+
+#endif //CAUSALITY_GRAPH_PARALLEL_H
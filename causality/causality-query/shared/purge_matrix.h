@@ -0,0 +1,232 @@
+#ifndef CAUSALITY_GRAPH_PURGE_MATRIX_H
+#define CAUSALITY_GRAPH_PURGE_MATRIX_H
+
+#include <vector>
+#include <span>
+#include <cstring>
+#include <ostream>
+#include "model.h"
+#include "analysis.h"
+
+using namespace std;
+
+/* Purge matrix that stores the unpurged reachability once, and for each row only the methods lost relative to it.
+ *
+ * Layout (all integers little-endian):
+ *   Header                 magic, uint32 version, uint32 n_methods (including the root), uint32 n_rows, uint64 row data size
+ *   Baseline               ceil(n_methods / 8) bytes, bit i set if method i is reachable, as in the rows of the dense purge matrix
+ *   Row index              (n_rows + 1) uint64 offsets into the row data, row i spans [offset i, offset i+1)
+ *   Row data               per row ascending method ids, each as LEB128 varint of its difference to the previous one
+ *
+ * With magic "CQPM", row i lists the methods lost by purging method i+1.
+ * Purging only ever removes methods, so the rows are exactly described by what they lack.
+ * With magic "CQPT", the matrix is transposed: Row i lists the methods whose purge alone makes method i unreachable. */
+struct SparsePurgeMatrixHeader
+{
+    static constexpr char rows_magic[4] = {'C', 'Q', 'P', 'M'};
+    static constexpr char transposed_magic[4] = {'C', 'Q', 'P', 'T'};
+    static constexpr uint32_t current_version = 1;
+
+    char magic[4];
+    uint32_t version;
+    uint32_t n_methods;
+    uint32_t n_rows;
+    uint64_t row_data_size;
+};
+
+static_assert(sizeof(SparsePurgeMatrixHeader) == 24);
+
+// Takes the reachability of the purges of method 1, 2, ... in this order
+class SparsePurgeMatrixWriter
+{
+    bool transposed;
+    // Visited bits of the unpurged fixpoint, 64 methods per word
+    vector<uint64_t> baseline;
+    size_t n_methods;
+    size_t n_purges = 0;
+    // Encoded rows, and the last id written to each
+    vector<vector<uint8_t>> rows;
+    vector<uint32_t> last_ids;
+
+    void append(uint32_t row, uint32_t id)
+    {
+        auto& data = rows[row];
+        uint32_t v = id - last_ids[row];
+        last_ids[row] = id;
+
+        while(v >= 0x80)
+        {
+            data.push_back((uint8_t)(v | 0x80));
+            v >>= 7;
+        }
+        data.push_back((uint8_t)v);
+    }
+
+public:
+    template<bool with_dists>
+    explicit SparsePurgeMatrixWriter(const MethodStates<with_dists>& all, bool transposed = false) : transposed(transposed), baseline(all.visited_words()), n_methods(all.size()), rows(transposed ? all.size() : 0), last_ids(rows.size())
+    {}
+
+    template<bool with_dists>
+    void add_purge(const MethodStates<with_dists>& methods)
+    {
+        uint32_t purged = ++n_purges;
+
+        if(!transposed)
+        {
+            rows.emplace_back();
+            last_ids.push_back(0);
+        }
+
+        methods.for_each_lost(baseline, [&](method_id mid)
+        {
+            if(transposed)
+                append(mid.id, purged);
+            else
+                append(rows.size() - 1, mid.id);
+        });
+    }
+
+    void write(ostream& out) const
+    {
+        const char* magic = transposed ? SparsePurgeMatrixHeader::transposed_magic : SparsePurgeMatrixHeader::rows_magic;
+
+        vector<uint64_t> row_offsets(1, 0);
+        for(const auto& row : rows)
+            row_offsets.push_back(row_offsets.back() + row.size());
+
+        SparsePurgeMatrixHeader header;
+        std::copy(magic, magic + sizeof(header.magic), header.magic);
+        header.version = SparsePurgeMatrixHeader::current_version;
+        header.n_methods = n_methods;
+        header.n_rows = rows.size();
+        header.row_data_size = row_offsets.back();
+        out.write((const char*)&header, sizeof(header));
+
+        vector<uint8_t> baseline_bytes((n_methods + 7) / 8);
+        for(size_t i = 0; i < baseline_bytes.size(); i++)
+            baseline_bytes[i] = (uint8_t)(baseline[i / 8] >> (i % 8 * 8));
+        out.write((const char*)baseline_bytes.data(), baseline_bytes.size());
+
+        out.write((const char*)row_offsets.data(), row_offsets.size() * sizeof(uint64_t));
+        for(const auto& row : rows)
+            out.write((const char*)row.data(), row.size());
+    }
+};
+
+// Read access to a sparse purge matrix of either orientation, without decoding more than the requested row
+class SparsePurgeMatrix
+{
+    SparsePurgeMatrixHeader header{};
+    span<const uint8_t> baseline;
+    const uint8_t* row_offsets = nullptr;
+    span<const uint8_t> row_data;
+    bool _valid = false;
+    bool _transposed = false;
+
+    [[nodiscard]] uint64_t row_offset(size_t i) const
+    {
+        uint64_t offset;
+        memcpy(&offset, row_offsets + i * sizeof(uint64_t), sizeof(uint64_t));
+        return offset;
+    }
+
+public:
+    explicit SparsePurgeMatrix(span<const uint8_t> data)
+    {
+        if(data.size() < sizeof(header))
+            return;
+
+        memcpy(&header, data.data(), sizeof(header));
+
+        _transposed = std::equal(std::begin(header.magic), std::end(header.magic), std::begin(SparsePurgeMatrixHeader::transposed_magic));
+        bool rows = std::equal(std::begin(header.magic), std::end(header.magic), std::begin(SparsePurgeMatrixHeader::rows_magic));
+
+        if(!(rows || _transposed) || header.version != SparsePurgeMatrixHeader::current_version)
+            return;
+
+        // In 64 bits, which can't overflow from the 32-bit counts, unlike a 32-bit size_t
+        uint64_t baseline_size = ((uint64_t)header.n_methods + 7) / 8;
+        uint64_t index_size = ((uint64_t)header.n_rows + 1) * sizeof(uint64_t);
+        uint64_t available = data.size() - sizeof(header);
+
+        // The row data size gets compared last, since adding it could wrap around
+        if(baseline_size + index_size > available || header.row_data_size != available - baseline_size - index_size)
+            return;
+
+        baseline = data.subspan(sizeof(header), baseline_size);
+        row_offsets = data.data() + sizeof(header) + baseline_size;
+        row_data = data.subspan(sizeof(header) + baseline_size + index_size);
+
+        // The rows must follow each other within the row data, so that for_each_in_row() stays inside of it
+        if(row_offset(0) != 0 || row_offset(header.n_rows) != header.row_data_size)
+            return;
+        for(size_t i = 0; i < header.n_rows; i++)
+            if(row_offset(i) > row_offset(i + 1))
+                return;
+
+        _valid = true;
+    }
+
+    [[nodiscard]] bool valid() const { return _valid; }
+
+    // Whether the rows are indexed by the lost method instead of the purged one
+    [[nodiscard]] bool transposed() const { return _transposed; }
+
+    [[nodiscard]] size_t n_methods() const { return header.n_methods; }
+
+    [[nodiscard]] size_t n_rows() const { return header.n_rows; }
+
+    [[nodiscard]] bool reachable_unpurged(method_id m) const
+    {
+        return (baseline[m.id / 8] >> (m.id % 8)) & 1;
+    }
+
+    // Calls f(method_id) for the methods of the row, in ascending order.
+    // Stops at a varint that is cut off by the end of the row or is too long for 32 bits.
+    template<typename F>
+    void for_each_in_row(size_t row, F&& f) const
+    {
+        assert(valid() && row < n_rows());
+
+        uint64_t end = row_offset(row + 1);
+        uint32_t mid = 0;
+
+        for(uint64_t pos = row_offset(row); pos < end;)
+        {
+            uint32_t delta = 0;
+            bool complete = false;
+            for(unsigned shift = 0; !complete && shift < 32; shift += 7)
+            {
+                if(pos == end)
+                    return;
+
+                uint8_t byte = row_data[pos++];
+                delta |= uint32_t(byte & 0x7F) << shift;
+                complete = !(byte & 0x80);
+            }
+
+            if(!complete)
+                return;
+
+            mid += delta;
+            f(method_id(mid));
+        }
+    }
+
+    // Whether m stays reachable when purging the given method
+    [[nodiscard]] bool reachable(method_id purged, method_id m) const
+    {
+        if(!reachable_unpurged(m))
+            return false;
+
+        bool lost = false;
+        if(transposed())
+            for_each_in_row(m.id, [&](method_id other) { lost |= other == purged; });
+        else
+            for_each_in_row(purged.id - 1, [&](method_id other) { lost |= other == m; });
+        return !lost;
+    }
+};
+
+#endif //CAUSALITY_GRAPH_PURGE_MATRIX_H
@@ -0,0 +1,320 @@
+#ifndef CAUSALITY_GRAPH_PURGE_SEARCH_H
+#define CAUSALITY_GRAPH_PURGE_SEARCH_H
+
+#include <vector>
+#include <span>
+#include <string>
+#include <functional>
+#include "model.h"
+#include "analysis.h"
+#include "parallel.h"
+#include "dominators.h"
+
+using namespace std;
+
+// A set of methods that gets purged as a whole, e.g. a single method or all methods of a class
+struct PurgeCandidate
+{
+    string name;
+    vector<method_id> mids;
+};
+
+struct RankedPurge
+{
+    uint32_t candidate;
+    uint64_t gain;
+};
+
+// One candidate per method that is reachable in the unpurged fixpoint
+static vector<PurgeCandidate> method_purge_candidates(const BFS<true>& all, const vector<string>& method_names)
+{
+    vector<PurgeCandidate> candidates;
+
+    for(size_t i = 1; i < method_names.size(); i++)
+        if(all.methods.visited(i))
+            candidates.push_back({method_names[i], {method_id(i)}});
+
+    return candidates;
+}
+
+/* One candidate per class, containing its reachable methods.
+ * The class is the part of the qualified method name before the last '.' that precedes the parameter list.
+ * Methods whose name has no such dot form a candidate on their own. */
+static vector<PurgeCandidate> class_purge_candidates(const BFS<true>& all, const vector<string>& method_names)
+{
+    vector<PurgeCandidate> candidates;
+    unordered_map<string_view, uint32_t> candidate_by_class;
+
+    for(size_t i = 1; i < method_names.size(); i++)
+    {
+        if(!all.methods.visited(i))
+            continue;
+
+        string_view name = method_names[i];
+        string_view cls = name.substr(0, name.find('('));
+        size_t dot = cls.rfind('.');
+        cls = dot == string_view::npos ? name : cls.substr(0, dot);
+
+        auto [it, inserted] = candidate_by_class.emplace(cls, candidates.size());
+        if(inserted)
+            candidates.push_back({string(cls), {}});
+        candidates[it->second].mids.push_back(i);
+    }
+
+    return candidates;
+}
+
+/* Everything of the unpurged fixpoint that may get lost by purging some methods, i.e. what is forward-reachable from them in the SupportGraph.
+ * Its costs, including those of the types its methods instantiate, are an upper bound for the PurgeGain.
+ * Types only get into allInstantiated via saturated typeflows. Once such a typeflow is part of the cone,
+ * everything that got types from allInstantiated via saturation may get lost as well. The costs of that part are the same for every cone,
+ * thus they get computed once and added without traversing it again, which may count some costs twice. */
+class ForwardCone
+{
+    const PurgeDominance& d;
+    // Typeflows that put their types into allInstantiated, i.e. saturated ones and those with a saturated successor
+    vector<bool> feeds_all_instantiated;
+    // Costs of the cone of the typeflows that got types from allInstantiated
+    uint64_t all_instantiated_cost = 0;
+
+    // Scratch space, all false between calls
+    vector<bool> included;
+    vector<uint32_t> touched;
+    vector<uint32_t> worklist;
+
+    // Returns true if the cone reaches a typeflow that feeds allInstantiated
+    bool explore(uint64_t& cost, uint64_t limit)
+    {
+        bool feeds = false;
+
+        while(!worklist.empty() && cost < limit)
+        {
+            uint32_t n = worklist.back();
+            worklist.pop_back();
+
+            if(d.g.is_method(n))
+            {
+                cost += d.adj.method_costs[n];
+                for(type_t t : d.adj.methods[n].instantiated_types)
+                    cost += d.adj.type_costs[t];
+            }
+            else
+                feeds |= feeds_all_instantiated[n - d.adj.n_methods()];
+
+            d.g.for_each_successor(n, [&](uint32_t w, SupportGraph::Kind kind, bool)
+            {
+                if(kind != SupportGraph::Kind::white_hole)
+                    include(w);
+            });
+        }
+
+        return feeds;
+    }
+
+    void include(uint32_t n)
+    {
+        if(!included[n])
+        {
+            included[n] = true;
+            touched.push_back(n);
+            worklist.push_back(n);
+        }
+    }
+
+    void reset()
+    {
+        for(uint32_t n : touched)
+            included[n] = false;
+        touched.clear();
+        worklist.clear();
+    }
+
+public:
+    explicit ForwardCone(const PurgeDominance& d) : d(d), feeds_all_instantiated(d.adj.n_typeflows()), included(d.g.n_nodes())
+    {
+        const Adjacency& adj = d.adj;
+        const auto& r = d.all;
+
+        for(size_t i = 0; i < adj.n_typeflows(); i++)
+        {
+            typeflow_id v = i;
+
+            if(!d.g.is_active(v))
+                continue;
+
+            bool saturated = r.typeflow_visited[i].is_saturated();
+            feeds_all_instantiated[i] = saturated;
+
+            for(typeflow_id w : adj[v].forward_edges)
+            {
+                if(r.typeflow_visited[w.id].is_saturated())
+                    feeds_all_instantiated[i] = true;
+
+                if(saturated && d.g.is_active(w))
+                    include(d.g.node(w));
+            }
+        }
+
+        explore(all_instantiated_cost, numeric_limits<uint64_t>::max());
+        reset();
+    }
+
+    // Stops as soon as the costs reach the limit, the result then is only known to be at least the limit
+    [[nodiscard]] uint64_t bound(span<const method_id> purged, uint64_t limit = numeric_limits<uint64_t>::max())
+    {
+        uint64_t cost = 0;
+
+        for(method_id m : purged)
+            if(d.all.methods.visited(m))
+                include(d.g.node(m));
+
+        if(explore(cost, limit))
+            cost += all_instantiated_cost;
+
+        reset();
+        return cost;
+    }
+};
+
+/* Finds the k candidates of the highest PurgeGain.
+ * The dominated costs of the candidates are lower bounds for their gains, so the k-th largest of them is a threshold
+ * that every result has to reach. Candidates whose forward cone stays below the threshold are skipped,
+ * the others get simulated incrementally in batches of growing size, in the order of decreasing lower bounds.
+ * After each batch, progress receives the best candidates so far, ordered by decreasing gain. */
+static vector<RankedPurge> search_top_purges(const PurgeDominance& d, span<const PurgeCandidate> candidates, size_t k, const function<void(span<const RankedPurge> best, size_t n_processed)>& progress = {})
+{
+    static constexpr size_t initial_batch_size = 64;
+    static constexpr size_t max_batch_size = 4096;
+
+    if(k == 0)
+        return {};
+
+    ForwardCone cone(d);
+    vector<uint64_t> lower_bounds(candidates.size());
+    vector<uint32_t> order(candidates.size());
+
+    for(size_t i = 0; i < candidates.size(); i++)
+    {
+        lower_bounds[i] = d.lower_bound(candidates[i].mids);
+        order[i] = i;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return lower_bounds[a] > lower_bounds[b]; });
+
+    uint64_t threshold = k <= order.size() ? lower_bounds[order[k - 1]] : 0;
+    vector<RankedPurge> best;
+    vector<PurgeTreeNode> batch;
+    vector<uint32_t> batch_candidates;
+    vector<uint64_t> batch_gains;
+    size_t batch_size = max(k, initial_batch_size);
+    size_t next = 0;
+
+    while(next < order.size())
+    {
+        batch.clear();
+        batch_candidates.clear();
+
+        for(; next < order.size() && batch.size() < batch_size; next++)
+        {
+            uint32_t c = order[next];
+
+            if(lower_bounds[c] < threshold && cone.bound(candidates[c].mids, threshold) < threshold)
+                continue;
+
+            batch.push_back({candidates[c].mids, {}});
+            batch_candidates.push_back(c);
+        }
+
+        // The results come in any order, so they get collected in batch order to keep ties stable
+        batch_gains.resize(batch.size());
+        bfs_incremental_parallel(d.adj, batch, [&](const PurgeTreeNode& node, const BFS<false>& r)
+        {
+            batch_gains[&node - batch.data()] = d.all.reached_cost - r.reached_cost;
+        });
+
+        for(size_t i = 0; i < batch.size(); i++)
+            best.push_back({batch_candidates[i], batch_gains[i]});
+
+        std::stable_sort(best.begin(), best.end(), [](const RankedPurge& a, const RankedPurge& b) { return a.gain > b.gain; });
+        if(best.size() > k)
+            best.resize(k);
+        if(best.size() == k)
+            threshold = max(threshold, best.back().gain);
+
+        if(progress)
+            progress(best, next);
+
+        batch_size = min(batch_size * 2, max(max_batch_size, k));
+    }
+
+    return best;
+}
+
+/* Greedily builds a set of up to budget candidates, picking the one of the highest marginal PurgeGain in each step.
+ * Marginal gains get evaluated lazily: A candidate is only re-simulated together with the current set if its last known gain
+ * is the highest among all candidates. As the PurgeGain is not submodular (purging two callers of a method may free more
+ * than the sum of purging each of them), outdated gains are no upper bounds and the result is a heuristic.
+ * The returned gains are the marginal ones at the time of the respective pick. */
+static vector<RankedPurge> greedy_purge_set(const PurgeDominance& d, span<const PurgeCandidate> candidates, size_t budget, const function<void(const RankedPurge& pick)>& progress = {})
+{
+    struct Estimate
+    {
+        uint64_t gain;
+        uint32_t candidate;
+        // Number of picks when the gain was computed
+        uint32_t round;
+
+        bool operator<(const Estimate& o) const
+        {
+            return gain != o.gain ? gain < o.gain : candidate > o.candidate;
+        }
+    };
+
+    priority_queue<Estimate> queue;
+
+    {
+        vector<PurgeTreeNode> singletons;
+        singletons.reserve(candidates.size());
+        for(const PurgeCandidate& c : candidates)
+            singletons.push_back({c.mids, {}});
+
+        bfs_incremental_parallel(d.adj, singletons, [&](const PurgeTreeNode& node, const BFS<false>& r)
+        {
+            queue.push({d.all.reached_cost - r.reached_cost, (uint32_t)(&node - singletons.data()), 0});
+        });
+    }
+
+    BfsWorkspace<false> workspace(d.adj);
+    vector<RankedPurge> picks;
+    vector<method_id> purged;
+    uint64_t purged_cost = d.all.reached_cost;
+
+    while(picks.size() < budget && !queue.empty() && queue.top().gain != 0)
+    {
+        Estimate e = queue.top();
+        queue.pop();
+
+        if(e.round == picks.size())
+        {
+            purged.insert(purged.end(), candidates[e.candidate].mids.begin(), candidates[e.candidate].mids.end());
+            purged_cost -= e.gain;
+            picks.push_back({e.candidate, e.gain});
+
+            if(progress)
+                progress(picks.back());
+        }
+        else
+        {
+            size_t n_purged = purged.size();
+            purged.insert(purged.end(), candidates[e.candidate].mids.begin(), candidates[e.candidate].mids.end());
+            uint64_t gain = purged_cost - workspace.run(purged).reached_cost;
+            purged.resize(n_purged);
+
+            queue.push({gain, e.candidate, (uint32_t)picks.size()});
+        }
+    }
+
+    return picks;
+}
+
+#endif //CAUSALITY_GRAPH_PURGE_SEARCH_H
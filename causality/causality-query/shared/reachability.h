@@ -4,6 +4,7 @@
 #include <iostream>
 #include <vector>
 #include <ranges>
+#include <span>
 #include "model.h"
 #include "analysis.h"
 
@@ -88,237 +89,196 @@ struct ReachabilityEdge
     bool operator==(const ReachabilityEdge& o) const = default;
 };
 
-namespace std {
-    template <>
-    struct hash<pair<method_id, method_id>> {
-        auto operator()(pair<method_id, method_id> e) const {
-            return hash<uint32_t>{}(e.first.id) ^ hash<uint32_t>{}(e.second.id);
-        }
-    };
-}  // namespace std
-
-
-static void get_reachability_of_method(unordered_map<pair<method_id, method_id>, uint32_t>& edges, const Adjacency& adj, const BFS& all, method_id m, vector<bool>& visited)
+/* Edges of an explanation in insertion order, deduplicated by their endpoints.
+ * The index is a linear-probing table that only grows, clearing it only touches the slots in use. */
+class ReachabilityEdgeSet
 {
-    size_t dist = all.method_history[m.id].dist;
+    static constexpr uint32_t empty_slot = numeric_limits<uint32_t>::max();
 
-    if(dist == 0)
-    {
-        return;
-    }
+    vector<ReachabilityEdge> _edges;
+    // Index into _edges per slot, and the slot of each edge
+    vector<uint32_t> slots = vector<uint32_t>(64, empty_slot);
+    vector<uint32_t> edge_slots;
 
-    if(visited[m.id])
+    [[nodiscard]] size_t find_slot(method_id from, method_id to) const
     {
-        return;
-    }
+        uint64_t key = (uint64_t)from.id << 32 | to.id;
+        size_t mask = slots.size() - 1;
 
-    visited[m.id] = true;
-
-    {
-        auto it = std::find_if(adj.methods[m.id].backward_edges.begin(), adj.methods[m.id].backward_edges.end(), [&](method_id prev)
-        { return all.method_history[prev.id].dist < dist; });
-
-        if(it != adj.methods[m.id].backward_edges.end())
+        for(size_t slot = (key * 0x9E3779B97F4A7C15ull) >> 32 & mask;; slot = (slot + 1) & mask)
         {
-            edges.insert({{*it, m}, numeric_limits<uint32_t>::max()});
-            get_reachability_of_method(edges, adj, all, *it, visited);
-            return;
+            uint32_t i = slots[slot];
+            if(i == empty_slot || (_edges[i].from == from && _edges[i].to == to))
+                return slot;
         }
     }
 
+    void grow()
     {
-        auto it = std::find_if(adj.methods[m.id].backward_hyperedges.begin(), adj.methods[m.id].backward_hyperedges.end(), [&](hyperedge_id he)
-        {
-            return all.method_history[adj[he].src1.id].dist < dist
-                && all.method_history[adj[he].src2.id].dist < dist;
-        });
+        clear_slots();
+        slots.resize(slots.size() * 2, empty_slot);
 
-        if(it != adj.methods[m.id].backward_hyperedges.end())
+        for(size_t i = 0; i < _edges.size(); i++)
         {
-            auto m1 = adj[*it].src1;
-            auto m2 = adj[*it].src2;
-            edges.insert({{m1, m}, numeric_limits<uint32_t>::max()});
-            get_reachability_of_method(edges, adj, all, m1, visited);
-            edges.insert({{m2, m}, numeric_limits<uint32_t>::max()});
-            get_reachability_of_method(edges, adj, all, m2, visited);
-            return;
+            size_t slot = find_slot(_edges[i].from, _edges[i].to);
+            slots[slot] = i;
+            edge_slots[i] = slot;
         }
     }
 
+    void clear_slots()
+    {
+        for(uint32_t slot : edge_slots)
+            slots[slot] = empty_slot;
+    }
 
-    // --- Do backwards-search in typeflow-nodes ---
-
-    vector<typeflow_id> parent(adj.n_typeflows());
-    queue<typeflow_id> worklist;
-
-    typeflow_id start_flow;
-    uint16_t flow_type;
-    uint8_t flow_type_dist = numeric_limits<uint8_t>::max();
-
-    for(typeflow_id flow : adj[m].virtual_invocation_sources)
+public:
+    // Returns the edge from -> to, which gets added with the given type unless already present
+    ReachabilityEdge& insert(method_id from, method_id to, uint32_t via_type)
     {
-        if(!all.method_history[adj[flow].method.dependent().id])
-            continue;
+        if((_edges.size() + 1) * 2 > slots.size())
+            grow();
 
-        const TypeflowHistory& history = all.typeflow_visited[flow.id];
+        size_t slot = find_slot(from, to);
 
-        for(auto pair : history)
+        if(slots[slot] == empty_slot)
         {
-            if(pair.second < flow_type_dist)
-            {
-                flow_type = pair.first;
-                flow_type_dist = pair.second;
-                start_flow = flow;
-            }
+            slots[slot] = _edges.size();
+            edge_slots.push_back(slot);
+            _edges.push_back({from, to, via_type});
         }
 
-        if(history.is_saturated())
-        {
-            if(history.saturated_dist < flow_type_dist)
-            {
-                flow_type = adj[flow].filter.first();
-                flow_type_dist = history.saturated_dist;
-                start_flow = flow;
-            }
-        }
+        return _edges[slots[slot]];
     }
 
-    if(flow_type_dist > dist)
+    void clear()
     {
-        cerr << "Lost reachability trace due to saturation! (1)" << endl;
-        return;
+        clear_slots();
+        edge_slots.clear();
+        _edges.clear();
     }
 
-    worklist.push(start_flow);
+    [[nodiscard]] span<const ReachabilityEdge> edges() const { return _edges; }
+};
+
+/* Explains the reachability of methods in a fixpoint by a hyperpath from the root.
+ * Each method gets explained by the call, hyperedge or typeflow that the BFS recorded as the cause of reaching it,
+ * and the methods involved in that get explained in turn. Types in typeflows are traced back to their allocation
+ * through the recorded sources, also across saturation. All scratch space is kept across calls. */
+class ReachabilityExplainer
+{
+    const Adjacency& adj;
+    const BFS<true>& all;
 
-    for(;;)
+    // Scratch space, visited is all false between calls
+    vector<typeflow_id> path;
+    vector<bool> visited;
+    vector<method_id> visited_methods;
+    vector<method_id> pending;
+    ReachabilityEdgeSet edges;
+
+    void explain_method(method_id m)
     {
-        if(worklist.empty())
+        PredecessorRecords::Method cause = all.predecessors.method(m);
+
+        switch(cause.kind)
         {
-            cerr << "Lost reachability trace due to saturation! (2)" << endl;
-            return;
+            case PredecessorRecords::Method::Kind::root:
+                break;
+            case PredecessorRecords::Method::Kind::call:
+                edges.insert(cause.id, m, numeric_limits<uint32_t>::max());
+                pending.emplace_back(cause.id);
+                break;
+            case PredecessorRecords::Method::Kind::hyperedge:
+                for(method_id src : {adj[hyperedge_id(cause.id)].src1, adj[hyperedge_id(cause.id)].src2})
+                {
+                    edges.insert(src, m, numeric_limits<uint32_t>::max());
+                    pending.push_back(src);
+                }
+                break;
+            case PredecessorRecords::Method::Kind::typeflow:
+                add_typeflow_path(m, cause.id, cause.type);
+                break;
         }
+    }
 
-        typeflow_id flow = worklist.front();
-        worklist.pop();
+    /* Adds the methods containing the typeflows that the type passed from its allocation to flow.
+     * Where the type arrived via saturation, the path continues at the typeflow that instantiated it,
+     * and includes the saturated typeflow due to which the arrival happened. */
+    void add_typeflow_path(method_id m, typeflow_id flow, type_t type)
+    {
+        path.clear();
 
-        if(all.typeflow_visited[flow.id].is_saturated() && all.typeflow_visited[flow.id].saturated_dist <= dist)
+        for(typeflow_id cur = flow; cur; )
         {
-            for(size_t v = 1; v < adj.n_typeflows(); v++)
-            {
-                if(v == flow || parent[v] || !all.method_history[adj.flows[v].method.dependent().id])
-                    continue;
+            path.push_back(cur);
+            typeflow_id source = all.predecessors.typeflow_type(all.typeflow_visited[cur.id], cur, type);
 
-                if(all.typeflow_visited[v].is_saturated() && all.typeflow_visited[v].saturated_dist <= dist && adj.flows[v].filter[flow_type])
-                {
-                    for(auto type_pair: all.typeflow_visited[v])
-                    {
-                        if(type_pair.first == flow_type)
-                        {
-                            parent[v] = flow;
-                            worklist.push(v);
-                        }
-                    }
-
-                    for(typeflow_id u : adj.flows[v].backward_edges)
-                    {
-                        if(u == flow || parent[u.id] || !all.method_history[adj[u].method.dependent().id])
-                            continue;
-
-                        for(auto type_pair : all.typeflow_visited[u.id])
-                        {
-                            if(type_pair.first == flow_type)
-                            {
-                                parent[u.id] = flow;
-                                worklist.push(u);
-                            }
-                        }
-                    }
-                }
+            if(source == PredecessorRecords::from_all_instantiated)
+            {
+                path.push_back(all.predecessors.saturation_use(cur));
+                source = all.predecessors.instantiation(type);
             }
+
+            cur = source;
         }
 
-        for(typeflow_id prev : adj[flow].backward_edges)
-        {
-            if(prev == 0)
-            {
-                vector<typeflow_id> history;
+        bool searching_for_invoker = true;
 
-                for(typeflow_id cur = flow; parent[cur.id] != numeric_limits<typeflow_id>::max(); cur = parent[cur.id])
-                    history.push_back(cur);
-                std::reverse(history.begin(), history.end());
+        for(typeflow_id f : path | views::reverse)
+        {
+            if(all.typeflow_visited[f.id].is_saturated())
+                searching_for_invoker = false;
 
-                bool searching_for_invoker = true;
+            auto containing_method = adj[f].method.dependent();
+            if(containing_method)
+            {
+                ReachabilityEdge& e = edges.insert(containing_method, m, type);
 
-                for(typeflow_id f : history)
+                if(searching_for_invoker)
                 {
-                    if(all.typeflow_visited[f.id].is_saturated())
-                        searching_for_invoker = false;
-
-                    auto containing_method = adj[f].method.dependent();
-                    if(containing_method)
-                    {
-                        auto inserted = edges.insert({{containing_method, m}, flow_type});;
-
-                        if(searching_for_invoker)
-                        {
-                            inserted.first->second = numeric_limits<uint32_t>::max();
-                            searching_for_invoker = false;
-                        }
-
-                        get_reachability_of_method(edges, adj, all, containing_method, visited);
-                    }
+                    e.via_type = numeric_limits<uint32_t>::max();
+                    searching_for_invoker = false;
                 }
 
-                return;
+                pending.push_back(containing_method);
             }
+        }
+    }
 
-            if(parent[prev.id])
-                continue;
+public:
+    ReachabilityExplainer(const Adjacency& adj, const BFS<true>& all) : adj(adj), all(all), visited(adj.n_methods())
+    {}
 
-            if(adj[prev].method.dependent().id && all.method_history[adj[prev].method.dependent().id].dist >= dist)
+    ReachabilityExplainer(const ReachabilityExplainer&) = delete;
+
+    /* Returns the edges of the hyperpath explaining m, valid until the next call.
+     * Methods marked in explained_before are treated as already explained and don't get explained again. */
+    span<const ReachabilityEdge> explain(method_id m, const vector<bool>* explained_before = nullptr)
+    {
+        edges.clear();
+        pending.push_back(m);
+
+        while(!pending.empty())
+        {
+            method_id cur = pending.back();
+            pending.pop_back();
+
+            if(!all.methods.visited(cur) || visited[cur.id] || (explained_before && (*explained_before)[cur.id]))
                 continue;
 
-            if(all.typeflow_visited[prev.id].is_saturated() && all.typeflow_visited[prev.id].saturated_dist <= dist)
-            {
-                parent[prev.id] = flow;
-                worklist.emplace(prev);
-            }
-            else
-            {
-                for(auto t2 : all.typeflow_visited[prev.id])
-                {
-                    if(flow_type == t2.first && t2.second <= dist)
-                    {
-                        parent[prev.id] = flow;
-                        worklist.emplace(prev);
-                        break;
-                    }
-                }
-            }
+            visited[cur.id] = true;
+            visited_methods.push_back(cur);
+            explain_method(cur);
         }
-    }
-}
 
-static vector<ReachabilityEdge> get_reachability(const Adjacency& adj, const BFS& all, method_id m)
-{
-    unordered_map<pair<method_id, method_id>, uint32_t> edges;
+        for(method_id v : visited_methods)
+            visited[v.id] = false;
+        visited_methods.clear();
 
-    if(!all.method_history[m.id])
-    {
-    }
-    else
-    {
-        vector<bool> visited(adj.n_methods());
-        get_reachability_of_method(edges, adj, all, m, visited);
+        return edges.edges();
     }
-
-    vector<ReachabilityEdge> result;
-    result.reserve(edges.size());
-    for(auto kv : edges)
-        result.push_back({kv.first.first, kv.first.second, kv.second});
-    return result;
-}
+};
 
 
 
@@ -371,17 +331,13 @@ static void print_reachability_of_method_internal(ostream& out, const vector<str
     print_reachability_of_method_internal(out, method_names, type_names, backedges.back().first, visited, indentation, path_adj_backward);
 }
 
-static void print_reachability_of_method(ostream& out, const Adjacency& adj, const vector<string>& method_names, const vector<string>& type_names, const BFS& all, method_id m, vector<bool>& visited, TreeIndenter& indentation)
+static void print_reachability_of_method(ostream& out, const vector<string>& method_names, const vector<string>& type_names, ReachabilityExplainer& explainer, method_id m, vector<bool>& visited, TreeIndenter& indentation)
 {
-    vector<bool> visited_dup = visited;
-    unordered_map<pair<method_id, method_id>, uint32_t> edges;
-    get_reachability_of_method(edges, adj, all, m, visited_dup);
-
     unordered_map<method_id, vector<pair<method_id, uint32_t>>> path_adj_backward;
 
-    for(auto& e : edges)
+    for(const ReachabilityEdge& e : explainer.explain(m, &visited))
     {
-        path_adj_backward[e.first.second].emplace_back(e.first.first, e.second);
+        path_adj_backward[e.to].emplace_back(e.from, e.via_type);
     }
 
     print_reachability_of_method_internal(out, method_names, type_names, m, visited, indentation, path_adj_backward);
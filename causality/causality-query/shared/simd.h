@@ -0,0 +1,58 @@
+#ifndef CAUSALITY_GRAPH_SIMD_H
+#define CAUSALITY_GRAPH_SIMD_H
+
+#include <cstdint>
+
+/* 128-bit SIMD kernels for the hot loops over typeflow histories.
+ * They are enabled by default for WebAssembly built with -msimd128, where the plain loops stay scalar.
+ * Native x86-64 builds gain nothing from them, but may enable them via -DCAUSALITY_SIMD=1 for testing the same code paths. */
+
+#ifndef CAUSALITY_SIMD
+#if defined(__wasm_simd128__)
+#define CAUSALITY_SIMD 1
+#else
+#define CAUSALITY_SIMD 0
+#endif
+#endif
+
+#if CAUSALITY_SIMD
+#if defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#else
+#error "CAUSALITY_SIMD requires WebAssembly SIMD or SSE2"
+#endif
+#endif
+
+#if CAUSALITY_SIMD
+
+// Bit i is set if lanes[i] is a or b, for i < 24. Always reads all 48 bytes at lanes.
+static inline uint32_t match_u16x24(const uint16_t* lanes, uint16_t a, uint16_t b)
+{
+#if defined(__wasm_simd128__)
+    v128_t va = wasm_i16x8_splat((int16_t)a);
+    v128_t vb = wasm_i16x8_splat((int16_t)b);
+    auto eq = [&](v128_t x) { return wasm_v128_or(wasm_i16x8_eq(x, va), wasm_i16x8_eq(x, vb)); };
+    v128_t eq0 = eq(wasm_v128_load(lanes));
+    v128_t eq1 = eq(wasm_v128_load(lanes + 8));
+    v128_t eq2 = eq(wasm_v128_load(lanes + 16));
+
+    return (uint32_t)wasm_i8x16_bitmask(wasm_i8x16_narrow_i16x8(eq0, eq1))
+         | (uint32_t)wasm_i16x8_bitmask(eq2) << 16;
+#else
+    __m128i va = _mm_set1_epi16((short)a);
+    __m128i vb = _mm_set1_epi16((short)b);
+    auto eq = [&](__m128i x) { return _mm_or_si128(_mm_cmpeq_epi16(x, va), _mm_cmpeq_epi16(x, vb)); };
+    __m128i eq0 = eq(_mm_loadu_si128((const __m128i*)lanes));
+    __m128i eq1 = eq(_mm_loadu_si128((const __m128i*)(lanes + 8)));
+    __m128i eq2 = eq(_mm_loadu_si128((const __m128i*)(lanes + 16)));
+
+    return (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(eq0, eq1))
+         | (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(eq2, _mm_setzero_si128())) << 16;
+#endif
+}
+
+#endif
+
+#endif //CAUSALITY_GRAPH_SIMD_H
@@ -0,0 +1,151 @@
+// Compares the scalar and the SIMD build of the WASM module under Node.
+//
+// Usage: node benchmark.mjs <build dir> <causality export dir> [number of purges]
+//
+// The build dir is the one of the web cmake project, containing causality-query.js and
+// causality-query-simd.js. Both variants run the same queries: Construction of the graph,
+// single-method purges, and a detailed simulation explaining the reachability of some methods.
+
+import { existsSync, readFileSync } from 'fs'
+import { join, resolve } from 'path'
+import { pathToFileURL } from 'url'
+
+const binaryFileNames = [
+    'typestates.bin',
+    'interflows.bin',
+    'direct_invokes.bin',
+    'typeflow_methods.bin',
+    'typeflow_filters.bin',
+    'hyper_edges.bin',
+    'method_costs.bin',
+    'type_costs.bin'
+]
+
+const [buildDir, exportDir, nPurgesArg] = process.argv.slice(2)
+
+if (!buildDir || !exportDir) {
+    console.error('Usage: node benchmark.mjs <build dir> <causality export dir> [number of purges]')
+    process.exit(1)
+}
+
+const nPurges = Number(nPurgesArg ?? 1000)
+
+function countLines(name) {
+    const text = readFileSync(join(exportDir, name), 'utf8')
+    return text.split('\n').filter((line) => line.length > 0).length
+}
+
+// The native side expects the typestates in rows of whole 64-bit words
+function padRows(data, rowLen, paddedRowLen) {
+    if (rowLen === paddedRowLen) return data
+    const nRows = data.length / rowLen
+    const padded = new Uint8Array(nRows * paddedRowLen)
+    for (let i = 0; i < nRows; i++)
+        padded.set(data.subarray(i * rowLen, (i + 1) * rowLen), i * paddedRowLen)
+    return padded
+}
+
+function time(f) {
+    const start = performance.now()
+    const result = f()
+    return [performance.now() - start, result]
+}
+
+async function run(variant) {
+    const path = resolve(buildDir, `${variant}.js`)
+    if (!existsSync(path)) return undefined
+
+    const Module = await (await import(pathToFileURL(path).href)).default()
+
+    const init = Module.cwrap('CausalityGraph_init', 'number', Array(18).fill('number'))
+    const simulatePurgeGain = Module.cwrap('CausalityGraph_simulatePurgeGain', 'number', [
+        'number',
+        'number',
+        'number'
+    ])
+    const simulatePurgeDetailed = Module.cwrap('CausalityGraph_simulatePurgeDetailed', 'number', [
+        'number',
+        'number',
+        'number'
+    ])
+    const getReachabilityHyperpath = Module.cwrap(
+        'DetailedSimulationResult_getReachabilityHyperpath',
+        'number',
+        ['number', 'number']
+    )
+    const deleteObject = Module.cwrap('Deletable_delete', 'void', ['number'])
+
+    const nMethods = countLines('methods.txt')
+    const nTypes = countLines('types.txt')
+
+    // Missing cost files are passed as empty buffers, making the native side use the default costs.
+    // The native side takes ownership of the buffers.
+    const buffers = binaryFileNames.map((name) => {
+        const file = join(exportDir, name)
+        let data = existsSync(file) ? readFileSync(file) : new Uint8Array()
+        if (name === 'typestates.bin')
+            data = padRows(data, Math.ceil(nTypes / 8), Math.ceil(nTypes / 64) * 8)
+        const ptr = Module._malloc(Math.max(data.length, 1))
+        Module.HEAPU8.set(data, ptr)
+        return [ptr, data.length]
+    })
+
+    const [initTime, graph] = time(() => init(nTypes, nMethods, ...buffers.flat()))
+
+    const midPtr = Module._malloc(4)
+    const step = Math.max(1, Math.floor(nMethods / nPurges))
+    const [purgeTime, gainSum] = time(() => {
+        let sum = 0
+        for (let mid = 1; mid <= nMethods; mid += step) {
+            Module.HEAPU32[midPtr / 4] = mid
+            sum += simulatePurgeGain(graph, midPtr, 1)
+        }
+        return sum
+    })
+    Module._free(midPtr)
+
+    const [detailedTime, edgeCount] = time(() => {
+        const result = simulatePurgeDetailed(graph, 0, 0)
+        let edges = 0
+        for (let mid = 1; mid <= nMethods; mid += step) {
+            const buf = getReachabilityHyperpath(result, mid)
+            edges += Module.HEAPU32[buf / 4]
+            Module._free(buf)
+        }
+        deleteObject(result)
+        return edges
+    })
+
+    deleteObject(graph)
+
+    return { variant, initTime, purgeTime, detailedTime, gainSum, edgeCount }
+}
+
+const results = []
+for (const variant of ['causality-query', 'causality-query-simd']) {
+    const result = await run(variant)
+    if (result) results.push(result)
+    else console.error(`${variant}.js not found in ${buildDir}, skipping`)
+}
+
+console.log(
+    'variant'.padEnd(24) +
+        'init [ms]'.padStart(12) +
+        'purges [ms]'.padStart(14) +
+        'detailed [ms]'.padStart(16)
+)
+for (const r of results) {
+    console.log(
+        r.variant.padEnd(24) +
+            r.initTime.toFixed(1).padStart(12) +
+            r.purgeTime.toFixed(1).padStart(14) +
+            r.detailedTime.toFixed(1).padStart(16)
+    )
+}
+
+if (results.length === 2) {
+    const [scalar, simd] = results
+    if (scalar.gainSum !== simd.gainSum || scalar.edgeCount !== simd.edgeCount)
+        console.error('The variants disagree on the results!')
+    console.log(`Speedup of purges: ${(scalar.purgeTime / simd.purgeTime).toFixed(2)}x`)
+}
@@ -2,6 +2,11 @@
 #define CHECK_ARGS 0
 
 #include <emscripten.h>
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include <emscripten/heap.h>
+#include <malloc.h>
+#include <unistd.h>
+#endif
 #include <iostream>
 #include <span>
 #include <utility>
@@ -10,6 +15,10 @@
 #include "../shared/input.h"
 #include "../shared/analysis.h"
 #include "../shared/reachability.h"
+#include "../shared/purge_matrix.h"
+#ifdef __EMSCRIPTEN_PTHREADS__
+#include "../shared/parallel.h"
+#endif
 
 class ProcessingStage
 {
@@ -61,56 +70,288 @@ struct EdgeBuffer
     }
 };
 
+struct MethodIdBuffer
+{
+    uint32_t len;
+    method_id mids[0];
+
+    static MethodIdBuffer* allocate_for(span<const method_id> mids)
+    {
+        void* buf = (void*)malloc(sizeof(MethodIdBuffer) + sizeof(mids[0]) * mids.size());
+        if(!buf)
+            exit(666);
+        MethodIdBuffer* midBuf = (MethodIdBuffer*)buf;
+        midBuf->len = mids.size();
+        std::copy(mids.begin(), mids.end(), midBuf->mids);
+        return midBuf;
+    }
+};
+
+/* Results of the steps of a batched purge, as records of 32-bit words.
+ * Each record holds the address of the PurgeTreeNode, the low and high half of its PurgeGain,
+ * the number of methods lost relative to the unpurged graph and their ascending ids. */
+struct SimulationStepBuffer
+{
+    uint32_t n_steps;
+    // Whether all purges have been simulated
+    uint32_t done;
+    uint32_t len;
+    uint32_t words[0];
+
+    static SimulationStepBuffer* allocate_for(size_t n_steps, bool done, span<const uint32_t> words)
+    {
+        void* buf = (void*)malloc(sizeof(SimulationStepBuffer) + sizeof(words[0]) * words.size());
+        if(!buf)
+            exit(666);
+        SimulationStepBuffer* stepBuf = (SimulationStepBuffer*)buf;
+        stepBuf->n_steps = n_steps;
+        stepBuf->done = done;
+        stepBuf->len = words.size();
+        std::copy(words.begin(), words.end(), stepBuf->words);
+        return stepBuf;
+    }
+};
+
+// Owns a copy of a transposed sparse purge matrix, which answers which single purges make a method unreachable
+class PurgeIndex : Deletable
+{
+    vector<uint8_t> data;
+    SparsePurgeMatrix matrix;
+
+public:
+    explicit PurgeIndex(vector<uint8_t>&& data) : data(std::move(data)), matrix(this->data) {}
+
+    // Whether it is a transposed purge matrix of a graph with n_methods methods (including the root)
+    [[nodiscard]] bool valid(size_t n_methods) const
+    {
+        return matrix.valid() && matrix.transposed() && matrix.n_methods() == n_methods && matrix.n_rows() == n_methods;
+    }
+
+    MethodIdBuffer* get_purging_methods(method_id mid) const
+    {
+        vector<method_id> purging;
+        if(mid.id < matrix.n_rows())
+            matrix.for_each_in_row(mid.id, [&](method_id m) { purging.push_back(m); });
+        return MethodIdBuffer::allocate_for(purging);
+    }
+};
+
+// Reachability without any purges, which results can be described relative to
+struct UnpurgedReachability
+{
+    vector<uint64_t> visited;
+    uint64_t reached_cost;
+    // Of the BFS state at this fixpoint, which no purged one exceeds by much
+    size_t bfs_memory_size;
+};
+
+template<bool with_dists>
+static MethodIdBuffer* lost_methods(const MethodStates<with_dists>& methods, const UnpurgedReachability& unpurged)
+{
+    vector<method_id> lost;
+    methods.for_each_lost(unpurged.visited, [&](method_id m) { lost.push_back(m); });
+    return MethodIdBuffer::allocate_for(lost);
+}
+
 struct SimulationResult : Deletable
 {
+    // One byte per method (except the root), containing its dist or 0xFF if unreachable
     virtual const uint8_t* get_method_history() const = 0;
+    // MethodStates::Block per 64 methods (including the root), holding interleaved visited and inhibited bits
+    virtual const uint8_t* get_packed_method_states() const = 0;
+    // Ascending ids of the methods that are reachable without purges, but not here.
+    // Usually far shorter than the method history.
+    virtual MethodIdBuffer* get_lost_methods() const = 0;
 };
 
+template<bool with_dists>
+static const uint8_t* expand_method_history(const MethodStates<with_dists>& methods, vector<uint8_t>& buffer)
+{
+    buffer.resize(methods.size());
+    methods.write_dists(buffer.data());
+    return &buffer[1];
+}
+
 class DetailedSimulationResult : SimulationResult
 {
     shared_ptr<const model> m;
-    BFS data;
+    shared_ptr<const UnpurgedReachability> unpurged;
+    BFS<true> data;
+    // Created on the first query, keeps its scratch space for the following ones
+    mutable optional<ReachabilityExplainer> explainer;
 
 public:
-    DetailedSimulationResult(shared_ptr<const model> m, BFS&& data) : m(std::move(m)), data(std::move(data)) {}
+    DetailedSimulationResult(shared_ptr<const model> m, shared_ptr<const UnpurgedReachability> unpurged, BFS<true>&& data) : m(std::move(m)), unpurged(std::move(unpurged)), data(std::move(data)) {}
 
     EdgeBuffer* get_reachability_hyperpath(method_id mid) const
     {
-        auto edges = get_reachability(m->adj, data, mid);
-        return EdgeBuffer::allocate_for(edges);
+        if(!data.methods.visited(mid))
+            return EdgeBuffer::allocate_for({});
+
+        if(!explainer)
+            explainer.emplace(m->adj, data);
+        return EdgeBuffer::allocate_for(explainer->explain(mid));
     }
 
     const uint8_t* get_method_history() const
     {
-        return reinterpret_cast<const uint8_t*>(&data.method_history[1]);
+        return &data.methods.dist_bytes()[1];
+    }
+
+    const uint8_t* get_packed_method_states() const
+    {
+        return reinterpret_cast<const uint8_t*>(data.methods.packed().data());
+    }
+
+    MethodIdBuffer* get_lost_methods() const
+    {
+        return lost_methods(data.methods, *unpurged);
     }
 };
 
 class SimpleSimulationResult : SimulationResult
 {
-    vector<DefaultMethodHistory> method_history;
+    shared_ptr<const UnpurgedReachability> unpurged;
+    MethodStates<false> methods;
+    mutable vector<uint8_t> method_history;
 
 public:
-    SimpleSimulationResult(BFS&& data) : method_history(std::move(data.method_history))
+    SimpleSimulationResult(shared_ptr<const UnpurgedReachability> unpurged, BFS<false>&& data) : unpurged(std::move(unpurged)), methods(std::move(data.methods))
+    {}
+
+    SimpleSimulationResult(shared_ptr<const UnpurgedReachability> unpurged, const BFS<false>& data) : unpurged(std::move(unpurged)), methods(data.methods)
     {}
 
     const uint8_t* get_method_history() const
     {
-        return reinterpret_cast<const uint8_t*>(&method_history[1]);
+        if(method_history.empty())
+            expand_method_history(methods, method_history);
+        return &method_history[1];
+    }
+
+    const uint8_t* get_packed_method_states() const
+    {
+        return reinterpret_cast<const uint8_t*>(methods.packed().data());
+    }
+
+    MethodIdBuffer* get_lost_methods() const
+    {
+        return lost_methods(methods, *unpurged);
+    }
+};
+
+// Memory the purge result cache of a CausalityGraph may use, holding at least one fixpoint
+static constexpr size_t purge_cache_budget = 128 << 20;
+
+#ifdef __EMSCRIPTEN_PTHREADS__
+// Memory the simulation threads of a batched purge may fill with results ahead of the consumer
+static constexpr size_t max_buffered_bytes = 64 << 20;
+
+// Heap that is neither allocated nor reserved for the purge cache and the buffered results.
+// The heap has a fixed size with pthreads, see CMakeLists.txt.
+static size_t free_heap_size()
+{
+    size_t free = emscripten_get_heap_size() - (size_t)sbrk(0) + mallinfo().fordblks;
+    size_t reserved = purge_cache_budget + max_buffered_bytes;
+    return free > reserved ? free - reserved : 0;
+}
+
+/* Threads of the pool that no batched purge of a graph is using.
+ * Starting a thread beyond the pool would need the event loop of this worker, which is blocked while waiting for results.
+ * The pool is sized for one graph, which is all the observatory keeps at a time.
+ * Batched purges that get abandoned before their end keep their threads, so later ones may get fewer. */
+class SimulationThreadPool
+{
+    size_t idle = default_thread_count();
+
+public:
+    // As many idle threads as the free heap has room for, possibly none.
+    // Each of them holds a BFS state and its journal, which take thread_memory together.
+    size_t acquire(size_t thread_memory)
+    {
+        size_t n_threads = min(idle, free_heap_size() / max(thread_memory, (size_t)1));
+        idle -= n_threads;
+        return n_threads;
+    }
+
+    void release(size_t n_threads)
+    {
+        idle += n_threads;
     }
 };
 
 class IncrementalSimulationResult : SimulationResult
 {
     shared_ptr<const model> m;
+    // Shared with the graph, which the result may outlive
+    shared_ptr<SimulationThreadPool> pool;
+    size_t n_threads;
+    // Simulates the subtrees in parallel, this thread only waits for their results in order
+    ParallelIncrementalBfs ibfs;
+    mutable vector<uint8_t> method_history;
+    shared_ptr<const UnpurgedReachability> unpurged;
+
+    // A journal holds at most the changes of a run from scratch, which takes about as much memory as the state
+    static size_t thread_memory(const UnpurgedReachability& unpurged)
+    {
+        return 2 * unpurged.bfs_memory_size;
+    }
+
+    static size_t max_buffered(const Adjacency& adj, size_t n_threads)
+    {
+        size_t step_size = (adj.n_methods() + MethodStates<false>::methods_per_block - 1) / MethodStates<false>::methods_per_block * sizeof(MethodStates<false>::Block);
+        return max((size_t)16, max_buffered_bytes / max((size_t)1, n_threads) / step_size);
+    }
+
+public:
+    IncrementalSimulationResult(shared_ptr<const model> m, const PurgeTreeNode* purge_root, shared_ptr<const UnpurgedReachability> unpurged, shared_ptr<SimulationThreadPool> pool)
+            : m(std::move(m)), pool(std::move(pool)), n_threads(this->pool->acquire(thread_memory(*unpurged))), ibfs(this->m->adj, {purge_root, 1}, n_threads, max_buffered(this->m->adj, n_threads)), unpurged(std::move(unpurged)) {}
+
+    ~IncrementalSimulationResult() override
+    {
+        pool->release(n_threads);
+    }
+
+    // Also stops the threads in the middle of their runs
+    void cancel()
+    {
+        ibfs.cancel();
+    }
+#else
+class IncrementalSimulationResult : SimulationResult
+{
+    shared_ptr<const model> m;
+    /* Checked by the runs of ibfs, but without pthreads nothing can set it while one is going on.
+     * So cancel() only takes effect between the calls of simulate_until(). */
+    atomic<bool> cancelled = false;
     IncrementalBfs ibfs;
+    mutable vector<uint8_t> method_history;
+    shared_ptr<const UnpurgedReachability> unpurged;
 
 public:
-    IncrementalSimulationResult(shared_ptr<const model> m, const PurgeTreeNode* purge_root) : m(std::move(m)), ibfs(this->m->adj, {purge_root, 1}) {}
+    IncrementalSimulationResult(shared_ptr<const model> m, const PurgeTreeNode* purge_root, shared_ptr<const UnpurgedReachability> unpurged) : m(std::move(m)), ibfs(this->m->adj, {purge_root, 1}, nullptr, &cancelled), unpurged(std::move(unpurged)) {}
 
+    void cancel()
+    {
+        cancelled = true;
+    }
+#endif
+
+    // Has to be expanded again after each step
     const uint8_t* get_method_history() const
     {
-        return reinterpret_cast<const uint8_t*>(&ibfs.current_result().method_history[1]);
+        return expand_method_history(ibfs.current_result().methods, method_history);
+    }
+
+    const uint8_t* get_packed_method_states() const
+    {
+        return reinterpret_cast<const uint8_t*>(ibfs.current_result().methods.packed().data());
+    }
+
+    // Lets the consumer follow the steps without transferring the whole reachability each time
+    MethodIdBuffer* get_lost_methods() const
+    {
+        return lost_methods(ibfs.current_result().methods, *unpurged);
     }
 
     // Returns address of corresponding PurgeTree node
@@ -118,26 +359,143 @@ public:
     {
         return ibfs.next();
     }
+
+    // PurgeGain of the current step
+    uint64_t get_gain() const
+    {
+        return unpurged->reached_cost - ibfs.current_result().reached_cost;
+    }
+
+    /* Simulates purges until budget_ms milliseconds have passed or max_nodes got simulated, but at least one.
+     * The time is taken here, as the clock of the caller may have another origin than emscripten_get_now() in pthreads builds.
+     * It only gets checked between the purges. */
+    SimulationStepBuffer* simulate_until(double budget_ms, size_t max_nodes)
+    {
+        double deadline_ms = emscripten_get_now() + budget_ms;
+        vector<uint32_t> words;
+        size_t n_steps = 0;
+        bool done = false;
+
+        while(n_steps < max(max_nodes, (size_t)1))
+        {
+            const PurgeTreeNode* node = ibfs.next();
+            if(!node)
+            {
+                done = true;
+                break;
+            }
+
+            uint64_t gain = get_gain();
+            words.push_back((uint32_t)(uintptr_t)node);
+            words.push_back((uint32_t)gain);
+            words.push_back((uint32_t)(gain >> 32));
+
+            size_t count_index = words.size();
+            words.push_back(0);
+            ibfs.current_result().methods.for_each_lost(unpurged->visited, [&](method_id m) { words.push_back(m.id); });
+            words[count_index] = words.size() - count_index - 1;
+
+            n_steps++;
+            if(emscripten_get_now() >= deadline_ms)
+                break;
+        }
+
+        return SimulationStepBuffer::allocate_for(n_steps, done, words);
+    }
 };
 
 class CausalityGraph : Deletable
 {
     shared_ptr<const model> purge_model;
+    // Only holds masks during simulate_edge_purge_gain()
+    EdgeOverlay overlay;
+    // Reused across simple simulations, since the interactive UI issues many of them
+    BfsWorkspace<false> workspace;
+    // Serves the purge sets the user selects, which tend to repeat
+    PurgeResultCache purge_cache;
+#ifdef __EMSCRIPTEN_PTHREADS__
+    // Threads for the batched purges
+    shared_ptr<SimulationThreadPool> thread_pool = std::make_shared<SimulationThreadPool>();
+#endif
+    // Shared with the results that describe themselves relative to it
+    shared_ptr<const UnpurgedReachability> unpurged;
+
+    const shared_ptr<const UnpurgedReachability>& get_unpurged()
+    {
+        if(!unpurged)
+        {
+            const BFS<false>& r = workspace.run();
+            unpurged = std::make_shared<UnpurgedReachability>(UnpurgedReachability{r.methods.visited_words(), r.reached_cost, r.used_memory_size()});
+        }
+        return unpurged;
+    }
+
+    uint64_t get_unpurged_cost()
+    {
+        return get_unpurged()->reached_cost;
+    }
 
 public:
-    explicit CausalityGraph(model&& purge_model) : purge_model(std::make_shared<model>(std::move(purge_model))) {}
+    explicit CausalityGraph(model&& purge_model) : purge_model(std::make_shared<model>(std::move(purge_model))), overlay(this->purge_model->adj), workspace(this->purge_model->adj, &overlay), purge_cache(this->purge_model->adj, purge_cache_budget) {}
+
+    SimpleSimulationResult* simulate_purge(span<const method_id> purge_set)
+    {
+        const auto& unpurged = get_unpurged();
+        return new SimpleSimulationResult(unpurged, purge_cache.run(purge_set));
+    }
+
+    // The methods lost by the purge, without keeping the rest of the result
+    MethodIdBuffer* simulate_purge_lost(span<const method_id> purge_set)
+    {
+        const auto& unpurged = get_unpurged();
+        return lost_methods(purge_cache.run(purge_set).methods, *unpurged);
+    }
+
+    // Including the root
+    [[nodiscard]] size_t n_methods() const
+    {
+        return purge_model->adj.n_methods();
+    }
 
-    SimpleSimulationResult* simulate_purge(span<const method_id> purge_set) const
+    [[nodiscard]] const PurgeResultCache::Stats& get_purge_cache_stats() const
     {
-        return new SimpleSimulationResult(std::move(BFS::run<false>(purge_model->adj, purge_set)));
+        return purge_cache.stats();
     }
 
-    DetailedSimulationResult* simulate_purge_detailed(span<const method_id> purge_set) const
+    uint64_t simulate_purge_gain(span<const method_id> purge_set)
     {
-        return new DetailedSimulationResult(purge_model, std::move(BFS::run<true>(purge_model->adj, purge_set)));
+        uint64_t before = get_unpurged_cost();
+        return before - workspace.run(purge_set).reached_cost;
     }
 
-    IncrementalSimulationResult* simulate_purges_batched(const PurgeTreeNode* purge_root) const
+    // Edges are given by their index in the input buffers.
+    // The gain is only meaningful if they all got masked, see mask_input_edges().
+    pair<EdgeMasking, uint64_t> simulate_edge_purge_gain(span<const uint32_t> direct_invokes, span<const uint32_t> interflows, span<const uint32_t> hyperedges)
+    {
+        uint64_t before = get_unpurged_cost();
+        uint64_t gain = 0;
+
+        EdgeMasking masking = mask_input_edges(overlay, *purge_model, direct_invokes, interflows, hyperedges);
+        if(masking == EdgeMasking::masked)
+            gain = before - workspace.run().reached_cost;
+
+        overlay.clear();
+        return {masking, gain};
+    }
+
+    DetailedSimulationResult* simulate_purge_detailed(span<const method_id> purge_set)
+    {
+        return new DetailedSimulationResult(purge_model, get_unpurged(), std::move(BFS<true>::run(purge_model->adj, purge_set)));
+    }
+
+    // Writes 1 for each target that stays reachable, and 0 otherwise
+    void simulate_purge_targeted(span<const method_id> purge_set, span<const method_id> targets, uint8_t* reachable) const
+    {
+        vector<bool> result = ::simulate_purge_targeted(purge_model->adj, purge_set, targets);
+        std::copy(result.begin(), result.end(), reachable);
+    }
+
+    IncrementalSimulationResult* simulate_purges_batched(const PurgeTreeNode* purge_root)
     {
         static_assert(sizeof(PurgeTreeNode) == 16);
         static_assert(offsetof(PurgeTreeNode, mids) == 0);
@@ -165,12 +523,19 @@ public:
         }
 #endif
 
-        return new IncrementalSimulationResult(purge_model, purge_root);
+#ifdef __EMSCRIPTEN_PTHREADS__
+        return new IncrementalSimulationResult(purge_model, purge_root, get_unpurged(), thread_pool);
+#else
+        return new IncrementalSimulationResult(purge_model, purge_root, get_unpurged());
+#endif
     }
 };
 
 extern "C" {
 
+/* Takes ownership of all buffers, which have to be allocated with malloc().
+ * The rows of the typestates have to be padded to whole 64-bit words, unlike in typestates.bin.
+ * The costs are optional, given they have one entry per method (without the root) and type. Returns nullptr otherwise. */
 CausalityGraph* EMSCRIPTEN_KEEPALIVE CausalityGraph_init(
         size_t n_types,
         size_t n_methods,
@@ -179,7 +544,9 @@ CausalityGraph* EMSCRIPTEN_KEEPALIVE CausalityGraph_init(
         uintptr_t direct_invokes_data, size_t direct_invokes_len,
         uintptr_t typeflow_methods_data, size_t typeflow_methods_len,
         uintptr_t typeflow_filters_data, size_t typeflow_filters_len,
-        uintptr_t hyperedges_data, size_t hyperedges_len)
+        uintptr_t hyperedges_data, size_t hyperedges_len,
+        uintptr_t method_costs_data, size_t method_costs_len,
+        uintptr_t type_costs_data, size_t type_costs_len)
 {
     size_t n_typeflows = typeflow_methods_len / sizeof(ContainingMethod);
 
@@ -195,12 +562,22 @@ CausalityGraph* EMSCRIPTEN_KEEPALIVE CausalityGraph_init(
         increase_by(data.type_names, n_types);
         increase_by(data.method_names, n_methods);
         increase_by(data.typeflow_names, n_typeflows);
-        read_typestate_bitsets(data.type_names.size(), data.typestates, (const uint8_t*) typestates_data, typestates_len);
-        read_buffer(data.interflows, (const uint8_t*) interflows_data, interflows_len);
-        read_buffer(data.direct_invokes, (const uint8_t*) direct_invokes_data, direct_invokes_len);
-        read_buffer(data.containing_methods, (const uint8_t*) typeflow_methods_data, typeflow_methods_len);
-        read_buffer(data.typeflow_filters, (const uint8_t*) typeflow_filters_data, typeflow_filters_len);
-        read_buffer(data.hyper_edges, (const uint8_t*) hyperedges_data, hyperedges_len);
+        // The typestates and edges are used in place, the other buffers get freed once copied
+        data.typestate_blocks = MallocBuffer<uint64_t>((void*) typestates_data, typestates_len);
+        read_typestate_bitsets(data.type_names.size(), data.typestate_blocks, data.typestates);
+        data.interflows = MallocBuffer<Edge<typeflow_id>>((void*) interflows_data, interflows_len);
+        data.direct_invokes = MallocBuffer<Edge<method_id>>((void*) direct_invokes_data, direct_invokes_len);
+        data.containing_methods = MallocBuffer<ContainingMethod>((void*) typeflow_methods_data, typeflow_methods_len);
+        data.typeflow_filters = MallocBuffer<uint32_t>((void*) typeflow_filters_data, typeflow_filters_len);
+        read_buffer(data.hyper_edges, MallocBuffer<HyperEdge<method_id>>((void*) hyperedges_data, hyperedges_len));
+        read_buffer(data.method_costs, MallocBuffer<uint32_t>((void*) method_costs_data, method_costs_len));
+        read_buffer(data.type_costs, MallocBuffer<uint32_t>((void*) type_costs_data, type_costs_len));
+
+        if(!data.costs_match())
+        {
+            cerr << "Costs don't match the number of methods and types" << endl;
+            return nullptr;
+        }
 
         purge_model.emplace(std::move(data));
     }
@@ -226,23 +603,66 @@ CausalityGraph* EMSCRIPTEN_KEEPALIVE CausalityGraph_init(
     }
 }
 
-SimpleSimulationResult* EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurge(const CausalityGraph* thisPtr, const method_id* purge_set_ptr, size_t purge_set_len)
+SimpleSimulationResult* EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurge(CausalityGraph* thisPtr, const method_id* purge_set_ptr, size_t purge_set_len)
 {
     ProcessingStage s("BFS on purged graph");
     return thisPtr->simulate_purge({purge_set_ptr, purge_set_len});
 }
 
-DetailedSimulationResult* EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurgeDetailed(const CausalityGraph* thisPtr, const method_id* purge_set_ptr, size_t purge_set_len)
+// Doubles represent the gains exactly for all practical purposes, and map to plain JS numbers
+double EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurgeGain(CausalityGraph* thisPtr, const method_id* purge_set_ptr, size_t purge_set_len)
+{
+    return (double)thisPtr->simulate_purge_gain({purge_set_ptr, purge_set_len});
+}
+
+// The returned buffer has to be freed by the caller
+MethodIdBuffer* EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurgeLost(CausalityGraph* thisPtr, const method_id* purge_set_ptr, size_t purge_set_len)
+{
+    return thisPtr->simulate_purge_lost({purge_set_ptr, purge_set_len});
+}
+
+// Returns -1 if some edge can't be simulated and -2 if some index is out of range, see mask_input_edges()
+double EMSCRIPTEN_KEEPALIVE CausalityGraph_simulateEdgePurgeGain(CausalityGraph* thisPtr, const uint32_t* direct_invokes_ptr, size_t direct_invokes_len, const uint32_t* interflows_ptr, size_t interflows_len, const uint32_t* hyperedges_ptr, size_t hyperedges_len)
+{
+    auto [masking, gain] = thisPtr->simulate_edge_purge_gain({direct_invokes_ptr, direct_invokes_len}, {interflows_ptr, interflows_len}, {hyperedges_ptr, hyperedges_len});
+
+    switch(masking)
+    {
+        case EdgeMasking::masked:
+            return (double)gain;
+        case EdgeMasking::contracted:
+        case EdgeMasking::instantiating:
+            return -1;
+        case EdgeMasking::out_of_range:
+            return -2;
+    }
+
+    return -2;
+}
+
+DetailedSimulationResult* EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurgeDetailed(CausalityGraph* thisPtr, const method_id* purge_set_ptr, size_t purge_set_len)
 {
     ProcessingStage s("Detailed BFS on purged graph");
     return thisPtr->simulate_purge_detailed({purge_set_ptr, purge_set_len});
 }
 
-IncrementalSimulationResult* EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurgesBatched(const CausalityGraph* thisPtr, const PurgeTreeNode* purge_root)
+void EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurgeTargeted(const CausalityGraph* thisPtr, const method_id* purge_set_ptr, size_t purge_set_len, const method_id* targets_ptr, size_t targets_len, uint8_t* reachable)
+{
+    ProcessingStage s("Targeted BFS on purged graph");
+    thisPtr->simulate_purge_targeted({purge_set_ptr, purge_set_len}, {targets_ptr, targets_len}, reachable);
+}
+
+IncrementalSimulationResult* EMSCRIPTEN_KEEPALIVE CausalityGraph_simulatePurgesBatched(CausalityGraph* thisPtr, const PurgeTreeNode* purge_root)
 {
     return thisPtr->simulate_purges_batched(purge_root);
 }
 
+// Counters of the purge result cache as three 32-bit words: hits, superset hits and misses
+const PurgeResultCache::Stats* EMSCRIPTEN_KEEPALIVE CausalityGraph_getPurgeCacheStats(const CausalityGraph* thisPtr)
+{
+    return &thisPtr->get_purge_cache_stats();
+}
+
 EdgeBuffer* EMSCRIPTEN_KEEPALIVE DetailedSimulationResult_getReachabilityHyperpath(const DetailedSimulationResult* thisPtr, method_id target)
 {
     return thisPtr->get_reachability_hyperpath(target);
@@ -253,11 +673,58 @@ const uint8_t* EMSCRIPTEN_KEEPALIVE SimulationResult_getMethodHistory(const Simu
     return thisPtr->get_method_history();
 }
 
+const uint8_t* EMSCRIPTEN_KEEPALIVE SimulationResult_getPackedMethodStates(const SimulationResult* thisPtr)
+{
+    return thisPtr->get_packed_method_states();
+}
+
+// The returned buffer has to be freed by the caller
+MethodIdBuffer* EMSCRIPTEN_KEEPALIVE SimulationResult_getLostMethods(const SimulationResult* thisPtr)
+{
+    return thisPtr->get_lost_methods();
+}
+
 const PurgeTreeNode* EMSCRIPTEN_KEEPALIVE IncrementalSimulationResult_simulateNext(IncrementalSimulationResult* thisPtr)
 {
     return thisPtr->simulate_next();
 }
 
+double EMSCRIPTEN_KEEPALIVE IncrementalSimulationResult_getGain(const IncrementalSimulationResult* thisPtr)
+{
+    return (double)thisPtr->get_gain();
+}
+
+// The returned buffer has to be freed by the caller
+SimulationStepBuffer* EMSCRIPTEN_KEEPALIVE IncrementalSimulationResult_simulateUntil(IncrementalSimulationResult* thisPtr, double budget_ms, size_t max_nodes)
+{
+    return thisPtr->simulate_until(budget_ms, max_nodes);
+}
+
+// Following simulations return no more purges. Doesn't free the result, which still has to be deleted.
+void EMSCRIPTEN_KEEPALIVE IncrementalSimulationResult_cancel(IncrementalSimulationResult* thisPtr)
+{
+    thisPtr->cancel();
+}
+
+// The data gets copied. Returns nullptr if it is no transposed sparse purge matrix of the graph.
+PurgeIndex* EMSCRIPTEN_KEEPALIVE PurgeIndex_init(const CausalityGraph* graph, const uint8_t* data, size_t len)
+{
+    auto index = new PurgeIndex(vector<uint8_t>(data, data + len));
+
+    if(!index->valid(graph->n_methods()))
+    {
+        delete index;
+        return nullptr;
+    }
+
+    return index;
+}
+
+MethodIdBuffer* EMSCRIPTEN_KEEPALIVE PurgeIndex_getPurgingMethods(const PurgeIndex* thisPtr, method_id mid)
+{
+    return thisPtr->get_purging_methods(mid);
+}
+
 void EMSCRIPTEN_KEEPALIVE Deletable_delete(Deletable* thisPtr)
 {
     delete thisPtr;
@@ -8,11 +8,16 @@ import { CausalityGraphData } from '../UniverseTypes/CausalityGraphUniverse'
 
 export interface AsyncCausalityGraph {
     simulatePurge(nodesToBePurged?: number[]): Promise<Uint8Array>
+    simulatePurgeLost(nodesToBePurged?: number[]): Promise<Uint32Array>
+    simulatePurgeGain(nodesToBePurged?: number[]): Promise<number>
+    simulateEdgePurgeGain(edges: original.EdgeSelection): Promise<number | undefined>
     simulatePurgeDetailed(nodesToBePurged?: number[]): Promise<AsyncDetailedSimulationResult>
+    simulatePurgeTargeted(nodesToBePurged: number[], targets: number[]): Promise<boolean[]>
     simulatePurgesBatched(
         purgeRoot: original.PurgeTreeNode<number>,
         prepurgeMids: number[]
     ): Promise<AsyncIncrementalSimulationResult>
+    getPurgeCacheStats(): Promise<original.PurgeCacheStats>
     delete(): void
 }
 
@@ -22,7 +27,13 @@ export interface AsyncSimulationResult {
 }
 
 export interface AsyncIncrementalSimulationResult extends AsyncSimulationResult {
-    simulateNext(): Promise<{ token: number; history: Uint8Array } | undefined>
+    simulateNext(): Promise<{ token: number; lost: Uint32Array } | undefined>
+    simulateFor(
+        budgetMs: number,
+        maxNodes: number
+    ): Promise<original.IncrementalSimulationSteps<number>>
+    cancel(): void
+    getGain(): Promise<number>
 }
 
 export interface AsyncDetailedSimulationResult extends AsyncSimulationResult {
@@ -36,7 +47,8 @@ export interface AsyncDetailedSimulationResult extends AsyncSimulationResult {
 export function loadCausalityGraphConstructor(): (
     nMethods: number,
     nTypes: number,
-    causalityData: CausalityGraphData
+    causalityData: CausalityGraphData,
+    costs?: original.PurgeCosts
 ) => Promise<AsyncCausalityGraph> {
     let workerCreated = false
     const tester = {
@@ -52,15 +64,16 @@ export function loadCausalityGraphConstructor(): (
             new (
                 nMethods: number,
                 nTypes: number,
-                causalityData: CausalityGraphData
+                causalityData: CausalityGraphData,
+                costs?: original.PurgeCosts
             ): Promise<AsyncCausalityGraph>
         }
-        return (nMethods, nTypes, causalityData) =>
-            new RemoteCausalityGraphWrapped(nMethods, nTypes, causalityData)
+        return (nMethods, nTypes, causalityData, costs) =>
+            new RemoteCausalityGraphWrapped(nMethods, nTypes, causalityData, costs)
     } else {
-        return (nMethods, nTypes, causalityData) =>
+        return (nMethods, nTypes, causalityData, costs) =>
             new Promise((resolve) =>
-                resolve(new UiAsyncCausalityGraph(nMethods, nTypes, causalityData))
+                resolve(new UiAsyncCausalityGraph(nMethods, nTypes, causalityData, costs))
             )
     }
 }
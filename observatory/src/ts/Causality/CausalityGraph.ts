@@ -3,9 +3,45 @@
 // './lib/causality-query.js' is autogenerated by the emscripten toolchain.
 // eslint-disable-next-line @typescript-eslint/ban-ts-comment
 // @ts-ignore
-import loadWASM from './lib/causality-query.js'
+import loadScalarWASM from './lib/causality-query.js'
 import { causalityBinaryFileNames, CausalityGraphBinaryData } from './CausalityGraphBinaryData'
 import { assert } from '../util/assert'
+
+// './lib/causality-query-simd.js' is the optional variant built with 128-bit SIMD.
+// It is only bundled if present, and only used if the engine supports SIMD.
+const simdVariant = Object.values(import.meta.glob('./lib/causality-query-simd.js'))[0]
+
+// Minimal module that only validates with SIMD support, as used by wasm-feature-detect
+const simdProbe = new Uint8Array([
+    0, 97, 115, 109, 1, 0, 0, 0, 1, 5, 1, 96, 0, 1, 123, 3, 2, 1, 0, 10, 10, 1, 8, 0, 65, 0, 253,
+    15, 253, 98, 11
+])
+
+// './lib/causality-query-mt.js' is the optional variant simulating batched purges on a pthread pool.
+// Its heap is a SharedArrayBuffer, which is only available on cross-origin isolated pages.
+const mtVariant = Object.values(import.meta.glob('./lib/causality-query-mt.js'))[0]
+
+// eslint-disable-next-line @typescript-eslint/no-explicit-any
+async function loadVariant(variant: () => Promise<unknown>, name: string): Promise<any> {
+    try {
+        // eslint-disable-next-line @typescript-eslint/no-explicit-any
+        return await ((await variant()) as { default: () => Promise<any> }).default()
+    } catch (e) {
+        console.warn(`Falling back from the ${name} causality-query:`, e)
+        return undefined
+    }
+}
+
+// eslint-disable-next-line @typescript-eslint/no-explicit-any
+async function loadWASM(): Promise<any> {
+    let module = undefined
+    if (mtVariant && globalThis.crossOriginIsolated && typeof SharedArrayBuffer !== 'undefined')
+        module = await loadVariant(mtVariant, 'multi-threaded')
+    if (!module && simdVariant && WebAssembly.validate(simdProbe))
+        module = await loadVariant(simdVariant, 'SIMD')
+    return module ?? (await loadScalarWASM())
+}
+
 // eslint-disable-next-line @typescript-eslint/no-explicit-any
 const Module: any = await loadWASM()
 
@@ -23,6 +59,29 @@ export interface PurgeTreeNode<Token> {
     token?: Token
 }
 
+// Cost of each method and type, indexed like their ids. Used for the PurgeGain of a purge set.
+// The method costs thus leave out the root, which only exists on the native side. Both need one entry per id if given.
+// Methods default to 1 and types to 0, such that gains count the purged methods.
+export interface PurgeCosts {
+    methods?: Uint32Array
+    types?: Uint32Array
+}
+
+// Counters of the cache that simulatePurge() and simulatePurgeLost() go through
+export interface PurgeCacheStats {
+    hits: number
+    // Misses that started from the result of a cached superset
+    supersetHits: number
+    misses: number
+}
+
+// Edges of the causality data, given by their index in the respective binary file
+export interface EdgeSelection {
+    directInvokes?: number[]
+    interflows?: number[]
+    hyperEdges?: number[]
+}
+
 function calcPurgeNodesCount(purgeRoot: PurgeTreeNode<unknown>) {
     let cnt = 1
     if (purgeRoot.mids && purgeRoot.children) cnt += 1
@@ -78,6 +137,33 @@ class NativeBuffer {
         this.ptr = 0
         this.len = 0
     }
+
+    // Hands the ownership over to the native side, which has to free the returned pointer
+    release(): number {
+        const ptr = this.ptr
+        NativeBuffer.finReg.unregister(this)
+        this.ptr = 0
+        this.len = 0
+        return ptr
+    }
+}
+
+// The native side refers to the typestates in place, which needs rows of whole 64-bit words
+function padTypestates(nTypes: number, typestates: Uint8Array): NativeBuffer {
+    const rowLen = Math.ceil(nTypes / 8)
+    const paddedRowLen = Math.ceil(nTypes / 64) * 8
+    const nRows = rowLen === 0 ? 0 : typestates.length / rowLen
+    const buffer = new NativeBuffer(nRows * paddedRowLen)
+    const view = buffer.viewU8
+
+    if (rowLen === paddedRowLen) {
+        view.set(typestates)
+    } else {
+        view.fill(0)
+        for (let i = 0; i < nRows; i++)
+            view.set(typestates.subarray(i * rowLen, (i + 1) * rowLen), i * paddedRowLen)
+    }
+    return buffer
 }
 
 class WasmObjectWrapper {
@@ -121,44 +207,85 @@ export class CausalityGraph extends WasmObjectWrapper {
     private static readonly _init = Module.cwrap(
         'CausalityGraph_init',
         'number',
-        Array(12).fill('number')
+        Array(16).fill('number')
     )
     private static readonly _simulatePurge = WasmObjectWrapper.instanceCWrap(
         'CausalityGraph_simulatePurge',
         'number',
         ['number', 'number']
     )
+    private static readonly _simulatePurgeGain = WasmObjectWrapper.instanceCWrap(
+        'CausalityGraph_simulatePurgeGain',
+        'number',
+        ['number', 'number']
+    )
+    private static readonly _simulatePurgeLost = WasmObjectWrapper.instanceCWrap(
+        'CausalityGraph_simulatePurgeLost',
+        'number',
+        ['number', 'number']
+    )
+    private static readonly _simulateEdgePurgeGain = WasmObjectWrapper.instanceCWrap(
+        'CausalityGraph_simulateEdgePurgeGain',
+        'number',
+        ['number', 'number', 'number', 'number', 'number', 'number']
+    )
     private static readonly _simulatePurgeDetailed = WasmObjectWrapper.instanceCWrap(
         'CausalityGraph_simulatePurgeDetailed',
         'number',
         ['number', 'number']
     )
+    private static readonly _simulatePurgeTargeted = WasmObjectWrapper.instanceCWrap(
+        'CausalityGraph_simulatePurgeTargeted',
+        'void',
+        ['number', 'number', 'number', 'number', 'number']
+    )
     private static readonly _simulatePurgesBatched = WasmObjectWrapper.instanceCWrap(
         'CausalityGraph_simulatePurgesBatched',
         'number',
         ['number']
     )
+    private static readonly _getPurgeCacheStats = WasmObjectWrapper.instanceCWrap(
+        'CausalityGraph_getPurgeCacheStats',
+        'number',
+        []
+    )
 
     private nMethods: number
 
-    public constructor(nMethods: number, nTypes: number, data: CausalityGraphBinaryData) {
-        const filesAsNativeByteArrays = causalityBinaryFileNames.map((name) => {
+    public constructor(
+        nMethods: number,
+        nTypes: number,
+        data: CausalityGraphBinaryData,
+        costs: PurgeCosts = {}
+    ) {
+        const nativeBuffers = causalityBinaryFileNames.map((name) => {
             const arr = data[name]
+            if (name === 'typestates.bin') return padTypestates(nTypes, arr)
             const buffer = new NativeBuffer(arr.length)
             buffer.viewU8.set(arr)
             return buffer
         })
 
+        // Empty buffers make the native side fall back to the default costs
+        for (const arr of [costs.methods, costs.types]) {
+            const bytes = arr
+                ? new Uint8Array(arr.buffer, arr.byteOffset, arr.byteLength)
+                : new Uint8Array()
+            const buffer = new NativeBuffer(bytes.length)
+            buffer.viewU8.set(bytes)
+            nativeBuffers.push(buffer)
+        }
+
+        // The native side takes ownership of the buffers and frees them once they aren't needed anymore
         const wasmObject = CausalityGraph._init(
             nTypes,
             nMethods,
-            ...filesAsNativeByteArrays.flatMap((buffer) => [
-                buffer.viewU8.byteOffset,
-                buffer.viewU8.byteLength
-            ])
+            ...nativeBuffers.flatMap((buffer) => {
+                const len = buffer.viewU8.byteLength
+                return [buffer.release(), len]
+            })
         )
-
-        for (const buffer of Object.values(filesAsNativeByteArrays)) buffer.delete()
+        if (wasmObject === 0) throw new RangeError('Costs do not match the number of methods and types')
 
         super(wasmObject)
         this.nMethods = nMethods
@@ -182,6 +309,64 @@ export class CausalityGraph extends WasmObjectWrapper {
         return methodHistory
     }
 
+    // Ascending ids of the methods that the purge makes unreachable.
+    // Much less to transfer than the full result of simulatePurge() if the purge is small.
+    public simulatePurgeLost(nodesToBePurged: number[] = []): Uint32Array {
+        const mids = new NativeBuffer(nodesToBePurged.length * 4)
+        const midsArray = mids.viewU32
+
+        for (let i = 0; i < nodesToBePurged.length; i++) midsArray[i] = nodesToBePurged[i] + 1
+
+        const midBufPtr = CausalityGraph._simulatePurgeLost(
+            this,
+            mids.viewU8.byteOffset,
+            nodesToBePurged.length
+        )
+        mids.delete()
+        return takeMethodIdBuffer(midBufPtr)
+    }
+
+    // Sum of the costs of what the purge makes unreachable, without transferring per-method results
+    public simulatePurgeGain(nodesToBePurged: number[] = []): number {
+        const mids = new NativeBuffer(nodesToBePurged.length * 4)
+        const midsArray = mids.viewU32
+
+        for (let i = 0; i < nodesToBePurged.length; i++) midsArray[i] = nodesToBePurged[i] + 1
+
+        const gain = CausalityGraph._simulatePurgeGain(
+            this,
+            mids.viewU8.byteOffset,
+            nodesToBePurged.length
+        )
+        mids.delete()
+        return gain
+    }
+
+    // Gain of removing the edges, or undefined if some of them got merged with others when optimizing typeflows
+    // or feed types with costs from the white hole.
+    // A parallel edge only goes away once all its copies are given.
+    public simulateEdgePurgeGain(edges: EdgeSelection): number | undefined {
+        const lists = [edges.directInvokes ?? [], edges.interflows ?? [], edges.hyperEdges ?? []]
+        const buffers = lists.map((list) => {
+            const buffer = new NativeBuffer(list.length * 4)
+            buffer.viewU32.set(list)
+            return buffer
+        })
+
+        const gain = CausalityGraph._simulateEdgePurgeGain(
+            this,
+            buffers[0].viewU8.byteOffset,
+            lists[0].length,
+            buffers[1].viewU8.byteOffset,
+            lists[1].length,
+            buffers[2].viewU8.byteOffset,
+            lists[2].length
+        )
+        for (const buffer of buffers) buffer.delete()
+        if (gain === -2) throw new RangeError('Edge index out of range')
+        return gain < 0 ? undefined : gain
+    }
+
     public simulatePurgeDetailed(nodesToBePurged: number[] = []): DetailedSimulationResult {
         const mids = new NativeBuffer(nodesToBePurged.length * 4)
         const midsArray = mids.viewU32
@@ -197,6 +382,34 @@ export class CausalityGraph extends WasmObjectWrapper {
         return new DetailedSimulationResult(this.nMethods, simulationResultPtr)
     }
 
+    // Cheaper than a full simulation if only a few methods are of interest
+    public simulatePurgeTargeted(nodesToBePurged: number[], targets: number[]): boolean[] {
+        const mids = new NativeBuffer(nodesToBePurged.length * 4)
+        const midsArray = mids.viewU32
+        for (let i = 0; i < nodesToBePurged.length; i++) midsArray[i] = nodesToBePurged[i] + 1
+
+        const targetMids = new NativeBuffer(targets.length * 4)
+        const targetMidsArray = targetMids.viewU32
+        for (let i = 0; i < targets.length; i++) targetMidsArray[i] = targets[i] + 1
+
+        const reachable = new NativeBuffer(targets.length)
+
+        CausalityGraph._simulatePurgeTargeted(
+            this,
+            mids.viewU8.byteOffset,
+            nodesToBePurged.length,
+            targetMids.viewU8.byteOffset,
+            targets.length,
+            reachable.viewU8.byteOffset
+        )
+
+        const result = Array.from(reachable.viewU8, (b) => b !== 0)
+        mids.delete()
+        targetMids.delete()
+        reachable.delete()
+        return result
+    }
+
     public simulatePurgesBatched<Token>(
         purgeRoot: PurgeTreeNode<Token>,
         prepurgeMids: number[] = []
@@ -280,6 +493,54 @@ export class CausalityGraph extends WasmObjectWrapper {
             indexToInputToken
         )
     }
+
+    public getPurgeCacheStats(): PurgeCacheStats {
+        const index = CausalityGraph._getPurgeCacheStats(this) / Module.HEAPU32.BYTES_PER_ELEMENT
+        const [hits, supersetHits, misses] = Module.HEAPU32.slice(index, index + 3)
+        return { hits, supersetHits, misses }
+    }
+}
+
+// Transposed sparse purge matrix, as written by "causality-query purge_matrix_sparse transposed"
+export class PurgeIndex extends WasmObjectWrapper {
+    private static readonly _init = WasmObjectWrapper.instanceCWrap(
+        'PurgeIndex_init',
+        'number',
+        ['number', 'number']
+    )
+    private static readonly _getPurgingMethods = WasmObjectWrapper.instanceCWrap(
+        'PurgeIndex_getPurgingMethods',
+        'number',
+        ['number']
+    )
+
+    private constructor(wasmObject: number) {
+        super(wasmObject)
+    }
+
+    // Returns undefined if the data is no transposed purge matrix of the graph
+    public static load(graph: CausalityGraph, data: Uint8Array): PurgeIndex | undefined {
+        const buffer = new NativeBuffer(data.length)
+        buffer.viewU8.set(data)
+        const indexPtr = PurgeIndex._init(graph, buffer.viewU8.byteOffset, data.length)
+        buffer.delete()
+        return indexPtr === 0 ? undefined : new PurgeIndex(indexPtr)
+    }
+
+    // Methods whose purge alone makes the method unreachable
+    public getPurgingMethods(mid: number): number[] {
+        return Array.from(takeMethodIdBuffer(PurgeIndex._getPurgingMethods(this, mid + 1)))
+    }
+}
+
+// Copies the ids out of a native MethodIdBuffer and frees it
+function takeMethodIdBuffer(midBufPtr: number): Uint32Array {
+    const midBufU32index = midBufPtr / Module.HEAPU32.BYTES_PER_ELEMENT
+    const len = Module.HEAPU32.at(midBufU32index)
+    const mids = Module.HEAPU32.slice(midBufU32index + 1, midBufU32index + 1 + len)
+    Module._free(midBufPtr)
+    for (let i = 0; i < mids.length; i++) mids[i] -= 1
+    return mids
 }
 
 export interface ReachabilityHyperpathEdge {
@@ -288,12 +549,38 @@ export interface ReachabilityHyperpathEdge {
     via_type: number | undefined
 }
 
+// Reachability view on the packed method states of a simulation result
+export class PackedReachability {
+    // Per block of 64 methods: two words of visited bits, followed by two words of inhibited bits
+    private readonly words: Uint32Array
+
+    constructor(words: Uint32Array) {
+        this.words = words
+    }
+
+    isReachable(i: number): boolean {
+        const mid = i + 1
+        const word = this.words[(mid >>> 6) * 4 + ((mid >>> 5) & 1)]
+        return ((word >>> (mid & 31)) & 1) !== 0
+    }
+}
+
 class SimulationResult extends WasmObjectWrapper {
     private static readonly _getMethodHistory = WasmObjectWrapper.instanceCWrap(
         'SimulationResult_getMethodHistory',
         'number',
         []
     )
+    private static readonly _getPackedMethodStates = WasmObjectWrapper.instanceCWrap(
+        'SimulationResult_getPackedMethodStates',
+        'number',
+        []
+    )
+    private static readonly _getLostMethods = WasmObjectWrapper.instanceCWrap(
+        'SimulationResult_getLostMethods',
+        'number',
+        []
+    )
 
     protected nMethods: number
 
@@ -306,6 +593,19 @@ class SimulationResult extends WasmObjectWrapper {
         const methodHistoryPtr = SimulationResult._getMethodHistory(this)
         return Module.HEAPU8.slice(methodHistoryPtr, methodHistoryPtr + this.nMethods)
     }
+
+    // Needs a quarter of the memory of the reachable array
+    getPackedReachability(): PackedReachability {
+        const packedPtr = SimulationResult._getPackedMethodStates(this)
+        const nBlocks = Math.ceil((this.nMethods + 1) / 64)
+        const wordIndex = packedPtr / Module.HEAPU32.BYTES_PER_ELEMENT
+        return new PackedReachability(Module.HEAPU32.slice(wordIndex, wordIndex + nBlocks * 4))
+    }
+
+    // Ascending ids of the methods that are reachable without purges, but not in this result
+    getLostMethods(): Uint32Array {
+        return takeMethodIdBuffer(SimulationResult._getLostMethods(this))
+    }
 }
 
 export class DetailedSimulationResult extends SimulationResult {
@@ -339,6 +639,19 @@ export class DetailedSimulationResult extends SimulationResult {
     }
 }
 
+export interface IncrementalSimulationStep<Token> {
+    token: Token
+    // Methods lost relative to the unpurged graph
+    lost: Uint32Array
+    gain: number
+}
+
+export interface IncrementalSimulationSteps<Token> {
+    steps: IncrementalSimulationStep<Token>[]
+    // Whether all purges have been simulated
+    done: boolean
+}
+
 export class IncrementalSimulationResult<Token> extends SimulationResult {
     private static readonly _simulateNext = WasmObjectWrapper.instanceCWrap(
         'IncrementalSimulationResult_simulateNext',
@@ -346,6 +659,24 @@ export class IncrementalSimulationResult<Token> extends SimulationResult {
         []
     )
 
+    private static readonly _getGain = WasmObjectWrapper.instanceCWrap(
+        'IncrementalSimulationResult_getGain',
+        'number',
+        []
+    )
+
+    private static readonly _simulateUntil = WasmObjectWrapper.instanceCWrap(
+        'IncrementalSimulationResult_simulateUntil',
+        'number',
+        ['number', 'number']
+    )
+
+    private static readonly _cancel = WasmObjectWrapper.instanceCWrap(
+        'IncrementalSimulationResult_cancel',
+        'void',
+        []
+    )
+
     mids: NativeBuffer
     subsetsArr: NativeBuffer
     indexToInputToken: (Token | undefined)[]
@@ -363,17 +694,55 @@ export class IncrementalSimulationResult<Token> extends SimulationResult {
         this.indexToInputToken = indexToInputToken
     }
 
-    simulateNext(): { token: Token; history: Uint8Array } | undefined {
+    // Returns the methods lost relative to the unpurged graph, which usually are few
+    simulateNext(): { token: Token; lost: Uint32Array } | undefined {
         while (true) {
             const curNode = IncrementalSimulationResult._simulateNext(this)
             if (curNode === 0) return
             const index = (curNode - this.subsetsArr.viewU8.byteOffset) / 16
             const inputNode = this.indexToInputToken[index]
-            if (inputNode !== undefined)
-                return { token: inputNode, history: this.getReachableArray() }
+            if (inputNode !== undefined) return { token: inputNode, lost: this.getLostMethods() }
         }
     }
 
+    // PurgeGain of the purge set last returned by simulateNext()
+    getGain(): number {
+        return IncrementalSimulationResult._getGain(this)
+    }
+
+    // Simulates purges for about budgetMs, but at most maxNodes and at least one.
+    // Returns the results of all purges that completed in the meantime.
+    simulateFor(budgetMs: number, maxNodes: number): IncrementalSimulationSteps<Token> {
+        const buf = IncrementalSimulationResult._simulateUntil(this, budgetMs, maxNodes)
+        const words = Module.HEAPU32
+        const header = buf / words.BYTES_PER_ELEMENT
+        const nSteps = words[header]
+        const done = words[header + 1] !== 0
+
+        const steps: IncrementalSimulationStep<Token>[] = []
+        let pos = header + 3
+        for (let i = 0; i < nSteps; i++) {
+            const node = words[pos]
+            const gain = words[pos + 1] + words[pos + 2] * 2 ** 32
+            const nLost = words[pos + 3]
+            const lost = words.slice(pos + 4, pos + 4 + nLost)
+            pos += 4 + nLost
+
+            for (let j = 0; j < lost.length; j++) lost[j] -= 1
+            const token = this.indexToInputToken[(node - this.subsetsArr.viewU8.byteOffset) / 16]
+            if (token !== undefined) steps.push({ token, lost, gain })
+        }
+        Module._free(buf)
+
+        return { steps, done }
+    }
+
+    // Following simulations return no more purges. Also stops those running on other threads,
+    // which only exist in pthreads builds.
+    cancel(): void {
+        IncrementalSimulationResult._cancel(this)
+    }
+
     delete() {
         super.delete()
         this.mids.delete()
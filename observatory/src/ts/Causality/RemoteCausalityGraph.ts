@@ -8,26 +8,51 @@ import { CausalityGraphBinaryData } from './CausalityGraphBinaryData'
 export class RemoteCausalityGraph {
     wrapped: original.CausalityGraph
 
-    public constructor(nMethods: number, nTypes: number, data: CausalityGraphBinaryData) {
-        this.wrapped = new original.CausalityGraph(nMethods, nTypes, data)
+    public constructor(
+        nMethods: number,
+        nTypes: number,
+        data: CausalityGraphBinaryData,
+        costs?: original.PurgeCosts
+    ) {
+        this.wrapped = new original.CausalityGraph(nMethods, nTypes, data, costs)
     }
 
     public simulatePurge(nodesToBePurged: number[] = []): Uint8Array {
         return this.wrapped.simulatePurge(nodesToBePurged)
     }
 
+    public simulatePurgeLost(nodesToBePurged: number[] = []): Uint32Array {
+        return this.wrapped.simulatePurgeLost(nodesToBePurged)
+    }
+
+    public simulatePurgeGain(nodesToBePurged: number[] = []): number {
+        return this.wrapped.simulatePurgeGain(nodesToBePurged)
+    }
+
+    public simulateEdgePurgeGain(edges: original.EdgeSelection): number | undefined {
+        return this.wrapped.simulateEdgePurgeGain(edges)
+    }
+
     public simulatePurgeDetailed(
         nodesToBePurged: number[] = []
     ): original.DetailedSimulationResult {
         return Comlink.proxy(this.wrapped.simulatePurgeDetailed(nodesToBePurged))
     }
 
+    public simulatePurgeTargeted(nodesToBePurged: number[], targets: number[]): boolean[] {
+        return this.wrapped.simulatePurgeTargeted(nodesToBePurged, targets)
+    }
+
     public simulatePurgesBatched(
         purgeRoot: original.PurgeTreeNode<number>,
         prepurgeMids: number[] = []
     ): original.IncrementalSimulationResult<number> {
         return Comlink.proxy(this.wrapped.simulatePurgesBatched(purgeRoot, prepurgeMids))
     }
+
+    public getPurgeCacheStats(): original.PurgeCacheStats {
+        return this.wrapped.getPurgeCacheStats()
+    }
 }
 
 Comlink.expose(RemoteCausalityGraph)
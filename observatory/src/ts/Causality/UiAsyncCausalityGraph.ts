@@ -12,8 +12,13 @@ import { CausalityGraphBinaryData } from './CausalityGraphBinaryData'
 export class UiAsyncCausalityGraph implements AsyncCausalityGraph {
     wrapped: original.CausalityGraph
 
-    public constructor(nMethods: number, nTypes: number, data: CausalityGraphBinaryData) {
-        this.wrapped = new original.CausalityGraph(nMethods, nTypes, data)
+    public constructor(
+        nMethods: number,
+        nTypes: number,
+        data: CausalityGraphBinaryData,
+        costs?: original.PurgeCosts
+    ) {
+        this.wrapped = new original.CausalityGraph(nMethods, nTypes, data, costs)
     }
 
     public async simulatePurge(nodesToBePurged: number[] = []): Promise<Uint8Array> {
@@ -21,6 +26,21 @@ export class UiAsyncCausalityGraph implements AsyncCausalityGraph {
         return this.wrapped.simulatePurge(nodesToBePurged)
     }
 
+    public async simulatePurgeLost(nodesToBePurged: number[] = []): Promise<Uint32Array> {
+        await new Promise((r) => setTimeout(r, 1))
+        return this.wrapped.simulatePurgeLost(nodesToBePurged)
+    }
+
+    public async simulatePurgeGain(nodesToBePurged: number[] = []): Promise<number> {
+        await new Promise((r) => setTimeout(r, 1))
+        return this.wrapped.simulatePurgeGain(nodesToBePurged)
+    }
+
+    public async simulateEdgePurgeGain(edges: original.EdgeSelection): Promise<number | undefined> {
+        await new Promise((r) => setTimeout(r, 1))
+        return this.wrapped.simulateEdgePurgeGain(edges)
+    }
+
     public async simulatePurgeDetailed(
         nodesToBePurged: number[] = []
     ): Promise<AsyncDetailedSimulationResult> {
@@ -30,6 +50,14 @@ export class UiAsyncCausalityGraph implements AsyncCausalityGraph {
         )
     }
 
+    public async simulatePurgeTargeted(
+        nodesToBePurged: number[],
+        targets: number[]
+    ): Promise<boolean[]> {
+        await new Promise((r) => setTimeout(r, 1))
+        return this.wrapped.simulatePurgeTargeted(nodesToBePurged, targets)
+    }
+
     public async simulatePurgesBatched(
         purgeRoot: original.PurgeTreeNode<number>,
         prepurgeMids: number[] = []
@@ -40,6 +68,10 @@ export class UiAsyncCausalityGraph implements AsyncCausalityGraph {
         )
     }
 
+    public async getPurgeCacheStats(): Promise<original.PurgeCacheStats> {
+        return this.wrapped.getPurgeCacheStats()
+    }
+
     public delete() {
         this.wrapped.delete()
     }
@@ -52,16 +84,32 @@ class UiAsyncIncrementalSimulationResult implements AsyncIncrementalSimulationRe
         this.wrapped = wrapped
     }
 
-    async simulateNext(): Promise<{ token: number; history: Uint8Array } | undefined> {
+    async simulateNext(): Promise<{ token: number; lost: Uint32Array } | undefined> {
         await new Promise((r) => setTimeout(r, 1))
         return this.wrapped.simulateNext()
     }
 
+    async simulateFor(
+        budgetMs: number,
+        maxNodes: number
+    ): Promise<original.IncrementalSimulationSteps<number>> {
+        await new Promise((r) => setTimeout(r, 1))
+        return this.wrapped.simulateFor(budgetMs, maxNodes)
+    }
+
+    cancel() {
+        this.wrapped.cancel()
+    }
+
     async getReachableArray(): Promise<Uint8Array> {
         await new Promise((r) => setTimeout(r, 1))
         return this.wrapped.getReachableArray()
     }
 
+    async getGain(): Promise<number> {
+        return this.wrapped.getGain()
+    }
+
     delete() {
         this.wrapped.delete()
     }
@@ -9,7 +9,7 @@ import {
 import { CutView } from './CutTool/CutView'
 import { ImageView } from './CutTool/ImageView'
 import { DetailView } from './CutTool/DetailView'
-import { PurgeResults, ReachabilityVector } from './CutTool/BatchPurgeScheduler'
+import { PurgeBaseline, PurgeResults, ReachabilityVector } from './CutTool/BatchPurgeScheduler'
 import { PurgeScheduler } from './CutTool/PurgeScheduler'
 import { AsyncCausalityGraph } from '../Causality/AsyncCausalityGraph'
 import { assert } from '../util/assert'
@@ -149,7 +149,7 @@ class CutTool {
 
         const cg = await universe.getCausalityGraph()
         const allReachable = new ReachabilityVector(
-            new PurgeResults(await cg.simulatePurge()),
+            new PurgeResults(new PurgeBaseline(await cg.simulatePurge())),
             universe.codesizeByNodeLabels
         )
         loadingPanel.hidden = true
@@ -243,7 +243,10 @@ class CutTool {
         if (!stillReachable) {
             // We have to simulate
             const purgeSet = [...new Set([...vs].flatMap(collectCgNodesInSubtree))]
-            stillReachable = new PurgeResults(await this.cg.simulatePurge(purgeSet))
+            stillReachable = new PurgeResults(
+                this.allReachable.results.baseline,
+                await this.cg.simulatePurgeLost(purgeSet)
+            )
         }
 
         this.additionalSimulationResults = undefined
@@ -6,7 +6,11 @@ import {
     AsyncCausalityGraph,
     AsyncIncrementalSimulationResult
 } from '../../Causality/AsyncCausalityGraph'
-import { PurgeTreeNode, Unreachable } from '../../Causality/CausalityGraph'
+import {
+    IncrementalSimulationSteps,
+    PurgeTreeNode,
+    Unreachable
+} from '../../Causality/CausalityGraph'
 import { assert } from '../../util/assert'
 
 /*
@@ -17,23 +21,64 @@ import { assert } from '../../util/assert'
  * and the BatchPurgeScheduler cares for combining multiple nodes to a request.
  */
 
-export class PurgeResults {
+// Reachability without any purges, which the PurgeResults only store their difference to
+export class PurgeBaseline {
     // Indexed by cg nodes, contains 0xFF iff the node is not reachable
-    private readonly reachableArr: Uint8Array
+    readonly reachableArr: Uint8Array
+
+    private lastCodesizes: number[] | undefined
+    private lastScalarProduct = 0
 
     constructor(reachableArr: Uint8Array) {
         this.reachableArr = reachableArr
     }
 
+    // Cached, since every PurgeResults adds to it with the same codesizes
+    scalarProduct(codesizes: number[]): number {
+        if (this.lastCodesizes !== codesizes) {
+            let sum = 0
+            assert(this.reachableArr.length == codesizes.length)
+            for (let i = 0; i < codesizes.length; i++)
+                if (this.reachableArr[i] === Unreachable) sum += codesizes[i]
+            this.lastCodesizes = codesizes
+            this.lastScalarProduct = sum
+        }
+        return this.lastScalarProduct
+    }
+}
+
+export class PurgeResults {
+    readonly baseline: PurgeBaseline
+    // Ascending cg nodes that are reachable in the baseline, but not here
+    private readonly lost: Uint32Array
+
+    constructor(baseline: PurgeBaseline, lost: Uint32Array = new Uint32Array()) {
+        this.baseline = baseline
+        this.lost = lost
+    }
+
+    private isLost(cgNode: number): boolean {
+        let lo = 0
+        let hi = this.lost.length
+        while (lo < hi) {
+            const mid = (lo + hi) >>> 1
+            if (this.lost[mid] < cgNode) lo = mid + 1
+            else hi = mid
+        }
+        return lo < this.lost.length && this.lost[lo] === cgNode
+    }
+
+    private isPurgedCgNode(cgNode: number): boolean {
+        return this.baseline.reachableArr[cgNode] === Unreachable || this.isLost(cgNode)
+    }
+
     isPurged(v: FullyHierarchicalNode): boolean {
-        return v.cgNode !== undefined && this.reachableArr[v.cgNode] === Unreachable
+        return v.cgNode !== undefined && this.isPurgedCgNode(v.cgNode)
     }
 
     scalarProduct(codesizes: number[]): number {
-        let sum = 0
-        assert(this.reachableArr.length == codesizes.length)
-        for (let i = 0; i < codesizes.length; i++)
-            if (this.reachableArr[i] === Unreachable) sum += codesizes[i]
+        let sum = this.baseline.scalarProduct(codesizes)
+        for (const i of this.lost) sum += codesizes[i]
         return sum
     }
 
@@ -43,7 +88,7 @@ export class PurgeResults {
         assert(cgNodes.length === sizes.length)
         let sum = 0
         for (let i = 0; i < cgNodes.length; i++) {
-            if (this.reachableArr[cgNodes[i]] === Unreachable) sum += sizes[i]
+            if (this.isPurgedCgNode(cgNodes[i])) sum += sizes[i]
         }
         return sum
     }
@@ -52,7 +97,7 @@ export class PurgeResults {
         const cgNodes = vs.cgNodes
         const sizes = vs.sizes
         assert(cgNodes.length === sizes.length)
-        return cgNodes.every((node) => this.reachableArr[node] === Unreachable)
+        return cgNodes.every((node) => this.isPurgedCgNode(node))
     }
 }
 
@@ -93,19 +138,31 @@ export class NodeSet {
     }
 }
 
+// Steps of a batch return after this time, so results stream in and the batch stays cancellable
+const stepBudgetMs = 15
+const maxPurgesPerStep = 256
+
 export class BatchPurgeScheduler {
     callback?: (node: FullyHierarchicalNode | undefined, data: PurgeResults) => void
 
     private readonly cg: AsyncCausalityGraph
+    private readonly baseline: PurgeBaseline
     private readonly prepurgeNodes: FullyHierarchicalNode[]
     private waitlist: FullyHierarchicalNode[] = []
     private runningBatch: AsyncIncrementalSimulationResult | undefined
     private runningIndexToNode: (FullyHierarchicalNode | undefined)[] = []
+    // Whether next() is waiting for a step of the running batch
+    private stepping = false
 
     private calcBaselineFirst: boolean
 
-    constructor(cg: AsyncCausalityGraph, prepurgeNodes: FullyHierarchicalNode[] = []) {
+    constructor(
+        cg: AsyncCausalityGraph,
+        baseline: PurgeBaseline,
+        prepurgeNodes: FullyHierarchicalNode[] = []
+    ) {
         this.cg = cg
+        this.baseline = baseline
         this.prepurgeNodes = prepurgeNodes
         this.calcBaselineFirst = prepurgeNodes.length > 0
     }
@@ -114,29 +171,53 @@ export class BatchPurgeScheduler {
         this.waitlist.push(...nodes)
     }
 
-    async next() {
+    // Abandons the requests and the running batch, whose results are stale
+    cancel() {
+        this.callback = undefined
+        this.waitlist = []
         if (this.runningBatch) {
-            const result = await this.runningBatch.simulateNext()
-            if (result === undefined) {
-                this.runningBatch.delete()
-                this.runningBatch = undefined
+            this.runningBatch.cancel()
+            // Otherwise next() deletes it once the step returns
+            if (!this.stepping) this.runningBatch.delete()
+            this.runningBatch = undefined
+        }
+    }
+
+    async next() {
+        const batch = this.runningBatch
+        if (batch) {
+            this.stepping = true
+            let result: IncrementalSimulationSteps<number>
+            try {
+                result = await batch.simulateFor(stepBudgetMs, maxPurgesPerStep)
+            } finally {
+                this.stepping = false
+            }
+
+            if (batch !== this.runningBatch) {
+                batch.delete()
                 return this.waitlist.length > 0
-            } else {
+            }
+
+            for (const step of result.steps) {
                 let node: FullyHierarchicalNode | undefined
-                if (result.token === -1) {
+                if (step.token === -1) {
                     assert(this.calcBaselineFirst)
                     this.calcBaselineFirst = false
                     node = undefined
                 } else {
-                    node = this.runningIndexToNode[result.token]
-                    if (node === undefined) return true
+                    node = this.runningIndexToNode[step.token]
+                    if (node === undefined) continue
                     assert(!this.calcBaselineFirst)
                 }
 
-                if (this.callback) {
-                    const stillReachable = result.history
-                    this.callback(node, new PurgeResults(stillReachable))
-                }
+                if (this.callback) this.callback(node, new PurgeResults(this.baseline, step.lost))
+            }
+
+            if (result.done) {
+                batch.delete()
+                this.runningBatch = undefined
+                return this.waitlist.length > 0
             }
             return true
         } else if (this.waitlist.length > 0) {
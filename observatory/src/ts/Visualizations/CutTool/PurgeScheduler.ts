@@ -52,7 +52,7 @@ export class PurgeScheduler {
     constructor(cg: AsyncCausalityGraph, allReachable: PurgeResults) {
         this.cg = cg
         this.allReachable = allReachable
-        this.singleBatchScheduler = new BatchPurgeScheduler(cg)
+        this.singleBatchScheduler = new BatchPurgeScheduler(cg, allReachable.baseline)
     }
 
     set paused(val: boolean) {
@@ -82,7 +82,7 @@ export class PurgeScheduler {
             if (this._detailSelectedNode) this.detailNeedsUpdate = true
         }
         if (this.additionalBatchScheduler) {
-            this.additionalBatchScheduler.callback = undefined
+            this.additionalBatchScheduler.cancel()
             this.additionalBatchScheduler = undefined
         }
         this.ensureProcessing()
@@ -108,6 +108,7 @@ export class PurgeScheduler {
         if (!this.additionalBatchScheduler) {
             this.additionalBatchScheduler = new BatchPurgeScheduler(
                 this.cg,
+                this.allReachable.baseline,
                 this._purgeSelectedNodes
             )
             this.additionalBatchScheduler.callback = this._additionalPurgeCallback